@@ -37,10 +37,71 @@ SOFTWARE.
 #define MR_DATA_ACK 0x50
 #define MR_DATA_NAK 0x58
 // macros for basic TWI operations
-#define i2c_wait() while (!(TWCR & (1<<TWINT)))
 #define i2c_status() (TWSR & 0xF8)
 #define i2c_read_ack() (TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWEA))
 #define i2c_read_nak() (TWCR=(1<<TWINT)|(1<<TWEN)|(0<<TWEA))
+// bus pins for recovery
+#define SCL_BIT 0x20
+#define SDA_BIT 0x10
+
+#ifdef I2CTRACE
+I2CTrace i2c_trace;
+#endif
+
+void BaseRadio::i2c_init(uint32_t speed)
+{
+  TWSR=0x00; // prescaler 1
+  TWBR=((F_CPU/speed)-16)/2;
+}
+
+// wait for TWI operation to complete. if it does not complete in
+// I2C_TIMEOUT loops, then the bus is recovered and 0 returned
+uint8_t BaseRadio::i2c_wait()
+{
+  uint16_t t=I2C_TIMEOUT;
+  while (!(TWCR & (1<<TWINT))) {
+    if (!--t) {
+      i2c_errors.timeouts++;
+      i2c_recover();
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// bus clear, clock out up to 9 bits so that a slave stuck in the
+// middle of a byte releases SDA, then generate stop condition
+void BaseRadio::i2c_recover()
+{
+  uint8_t i;
+  i2c_errors.recoveries++;
+  TWCR=0;                  // disconnect TWI from pins
+  DDRC&=~SDA_BIT;          // SDA input with pullup
+  PORTC|=SDA_BIT;
+  for (i=0;i<9 && !(PINC&SDA_BIT);i++) {
+    PORTC&=~SCL_BIT;
+    _delay_us(5);
+    PORTC|=SCL_BIT;
+    _delay_us(5);
+  }
+  PORTC&=~SCL_BIT;         // stop condition, SDA rising while SCL high
+  PORTC&=~SDA_BIT;
+  DDRC|=SDA_BIT;
+  _delay_us(5);
+  PORTC|=SCL_BIT;
+  _delay_us(5);
+  PORTC|=SDA_BIT;
+  _delay_us(5);
+}
+
+void BaseRadio::i2c_error(uint8_t status)
+{
+  if (status==ARBITRATION_LOST)
+    i2c_errors.arbitration++;
+  else
+    i2c_errors.naks++;
+  i2c_stop();
+}
 
 void BaseRadio::i2c_stop()
 {
@@ -49,13 +110,12 @@ void BaseRadio::i2c_stop()
 
 bool BaseRadio::i2c_start()
 {
-  TWSR = 0x00; // configure i2c clock
-  TWBR = 0x0C;
   TWCR =(1<<TWINT)|(1<<TWSTA)|(1<<TWEN);
-  i2c_wait();
-  if (i2c_status()!=START_SENT)
+  if (!i2c_wait())
+    return false;
+  if (i2c_status()!=START_SENT && i2c_status()!=START_REPEATED)
   {
-    i2c_stop();
+    i2c_error(i2c_status());
     return false;
   }
   return true;
@@ -66,14 +126,17 @@ uint8_t BaseRadio::i2c_send(uint8_t *buf,uint8_t count)
   uint8_t tc=0;
   while (count--) {
     TWDR=*buf++;
-    tc++;
     TWCR=(1<<TWINT)|(1<<TWEN);
-    i2c_wait();
+    if (!i2c_wait())
+      return tc;
     if (i2c_status()!=MT_DATA_ACK)
     {
-      break;
+      i2c_error(i2c_status());
+      return tc;
     }
+    tc++;
   }
+  i2c_stop();
   return tc;
 }
 
@@ -82,18 +145,24 @@ uint8_t BaseRadio::i2c_recv(uint8_t *buf,uint8_t count)
 uint8_t rc=0;
   while (count>1) {
     i2c_read_ack();
-    i2c_wait();
+    if (!i2c_wait())
+      return rc;
     count--;
     if (i2c_status()!=MR_DATA_ACK)
     {
-      i2c_stop();
+      i2c_error(i2c_status());
       return rc;
     }
     *buf++=TWDR;
     rc++;
   }
   i2c_read_nak();
-  i2c_wait();
+  if (!i2c_wait())
+    return rc;
+  if (i2c_status()==MR_DATA_NAK) {
+    *buf=TWDR;
+    rc++;
+  }
   i2c_stop();
   return rc;
 }
@@ -102,43 +171,38 @@ uint8_t rc=0;
 // return number of bytes successfully written
 uint8_t BaseRadio::i2c_write(uint8_t slave,uint8_t *buf,uint8_t count)
 {
-  uint8_t tc=0;
-  if (!i2c_start())
-  {
-    i2c_stop();
-    return tc;
-  }
-  TWDR=slave<<1; // SLA+W
-  TWCR=(1<<TWINT)|(1<<TWEN);
-  i2c_wait();
-  if (i2c_status()!=MT_SLA_ACK)
-  {
-    i2c_stop();
-    return tc;
+uint8_t n=0;
+  I2C_TRACE_START();
+  if (i2c_start()) {
+    TWDR=slave<<1; // SLA+W
+    TWCR=(1<<TWINT)|(1<<TWEN);
+    if (i2c_wait()) {
+      if (i2c_status()==MT_SLA_ACK)
+        n=i2c_send(buf,count);
+      else
+        i2c_error(i2c_status());
+    }
   }
-  tc=i2c_send(buf,count);
-  i2c_stop();
-  return tc;
+  I2C_TRACE(slave,count,n);
+  return n;
 }
 
 // read count bytes from slave to buf
 // returns number of bytes successfully read
 uint8_t BaseRadio::i2c_read(uint8_t slave,uint8_t *buf,uint8_t count)
 {
-  uint8_t rc=0;
-  if (!i2c_start())
-  {
-    i2c_stop();
-    return false;
-  }
-  TWDR=(slave<<1)|1; // SLA+R
-  TWCR=(1<<TWINT)|(1<<TWEN);
-  i2c_wait();
-  if (i2c_status()!=MR_SLA_ACK)
-  {
-    i2c_stop();
-    return false;
+uint8_t n=0;
+  I2C_TRACE_START();
+  if (i2c_start()) {
+    TWDR=(slave<<1)|1; // SLA+R
+    TWCR=(1<<TWINT)|(1<<TWEN);
+    if (i2c_wait()) {
+      if (i2c_status()==MR_SLA_ACK)
+        n=i2c_recv(buf,count);
+      else
+        i2c_error(i2c_status());
+    }
   }
-  rc=i2c_recv(buf,count);
-  return rc;
+  I2C_TRACE(slave|I2C_TRACE_READ,count,n);
+  return n;
 }
@@ -31,6 +31,10 @@ SOFTWARE.
 #include <avr/eeprom.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
+#include "region.hpp"
+#include "tmc.hpp"
+#include "i2ctrace.hpp"
+#include "telemetry.hpp"
 
 #define noPROGRAMTYPENAMES
 
@@ -38,23 +42,179 @@ SOFTWARE.
 extern const char * const _program_types[];
 #endif
 
+// shown for received characters that the display can not show
+#define RDS_PLACEHOLDER '_'
+
+// reception statistics, these are reset together with the decoder
+// on every retune. only read through telemetry, so they are there
+// in TELEMETRY builds only
+#ifdef TELEMETRY
+#define RDSSTATS
+#endif
+
+#ifdef RDSSTATS
+struct RDSStats
+{
+  uint16_t groups[32]; // received groups by type, 0A,0B,1A,1B...15B
+  uint16_t rejected;   // groups dropped because of PI mismatch
+  uint16_t toggles;    // radio text A/B flag changes
+  uint16_t ps_ticks;   // ticks from reset to complete station name, 0 if not yet
+  uint16_t rt_ticks;   // ticks from reset to complete radio text, 0 if not yet
+  uint16_t missed;     // RDS ready edges missed by radio polling
+  uint16_t cycles_max; // longest group decode, cpu cycles
+  uint32_t cycles;     // total decode time of timed groups
+  uint16_t timed;      // groups timed, only while meter Timer1 runs
+};
+#define RDSSTAT(x) (x)
+#else
+#define RDSSTAT(x)
+#endif
+
+// group types decoded, bit (type<<1)|version for each, as in block b.
+// handlers of groups not enabled are not compiled in. a build can set
+// RDS_GROUPS with -D, for example -DRDS_GROUPS=RDS_GROUPS_MIN
+#define RDS_GROUP(t,v) (1UL<<(((t)<<1)|(v)))
+#define RDS_GROUPS_MIN (RDS_GROUP(0,0)|RDS_GROUP(0,1)|RDS_GROUP(2,0)|RDS_GROUP(2,1))
+#define RDS_GROUPS_ALL (RDS_GROUPS_MIN|RDS_GROUP(1,0)|RDS_GROUP(3,0)| \
+  RDS_GROUP(4,0)|RDS_GROUP(8,0)|RDS_GROUP(10,0))
+#ifndef RDS_GROUPS
+#define RDS_GROUPS (RDS_GROUPS_MIN|RDS_GROUP(3,0)|RDS_GROUP(8,0))
+#endif
+#define RDS_ENABLED(t,v) (RDS_GROUPS&RDS_GROUP(t,v))
+
+// RadioText Plus, artist and title tags of radio text, as open
+// data application. rename to noRTPLUS to save RAM and flash
+#define RTPLUS
+
+#define ODA_NONE 0        // group type not assigned to known application
+#define ODA_RTPLUS 1      // handler numbers, index to application table
+#define ODA_AID_RTPLUS 0x4bd7
+
+// RT+ content types shown
+#define RTP_TITLE 1
+#define RTP_ARTIST 4
+
+// RDS character translation for the display, see rdsdecoder.cpp
+char rds_char(uint8_t c);
+
+// what a radio driver hands received groups to. the tuner has the
+// full RDSDecoder, the scanner a stripped one, see scanner.hpp
+class RDSReceiver
+{
+public:
+  virtual void decode_group(uint16_t b1,uint16_t b2,uint16_t b3,uint16_t b4) = 0;
+  virtual void missed_group() { }
+  virtual void reset() = 0;
+};
+
+class RDSDecoder;
+
+// group handler, gets blocks b, c and d of the group
+typedef void (*GroupHandler)(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+
+struct ODAApp
+{
+  uint16_t aid;         // application identification
+  GroupHandler handler;
+};
+
 // http://www.nrscstandards.org/DocumentArchive/NRSC-4%201998.pdf
-class RDSDecoder
+class RDSDecoder : public RDSReceiver
 {
 private:
   char rtbuf[65];   // text collection buf
+  uint8_t oda[16];  // application handler by group type, 4 bits each,
+                    // from 3A announcements
+#ifdef RTPLUS
+  uint8_t rtp_start[2]; // title and artist position in rt
+  uint8_t rtp_len[2];   // and length, 0 if not known
+  uint8_t rtp_toggle;   // item toggle bit, on change the item is new
+#endif
+  static const GroupHandler groups[32]; // in flash, by group type
+  static const ODAApp apps[]; // in flash, indexed by handler number
+  static void group_ps(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+  static void group_rt(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#if RDS_ENABLED(1,0)
+  static void group_ecc(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#endif
+#if RDS_ENABLED(3,0)
+  static void group_oda(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#endif
+#if RDS_ENABLED(4,0)
+  static void group_ct(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#endif
+#if RDS_ENABLED(8,0) && defined(TMC)
+  static void group_tmc(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#endif
+#if RDS_ENABLED(10,0)
+  static void group_ptyn(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#endif
+  void oda_register(uint8_t group,uint16_t aid);
+  uint8_t oda_handler(uint8_t group) { return (oda[group>>1]>>((group&1)<<2))&15; }
+#ifdef RTPLUS
+  void rtplus_tag(uint8_t type,uint8_t start,uint8_t len);
+  static void rtplus(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e);
+#endif
+  char psbuf[8];    // station name collection buf
+  uint16_t rt_seen; // bitmap of received radio text segments
+  uint8_t rt_last;  // last segment of radio text, where CR was seen
+  void new_rt(uint8_t channel);
+  void rt_chars(uint8_t pos,uint16_t block,uint8_t segment);
+  void rt_segment(uint8_t segment);
 protected:
-  char ps[9];       // station name
-  char rt[65];      // radio text
+  uint16_t pi;      // program identification
+  uint16_t candidate_pi; // PI of rejected group, confirmed if next one has it too
+  uint8_t primed;   // pi and ps are from preset, not confirmed yet
+  uint8_t ps_seen;  // bitmap of received station name segments
+  char ps[9];       // station name, updated when all segments are in
+  char rt[65];      // radio text, updated when all segments are in
   int8_t pty;       // program type
+#if RDS_ENABLED(4,0)
   char time[6];     // hh:mm local time
   char date[11];    // dd.mm.yyyy
-  uint8_t tchannel; // channel ID for RT, on change the buffer is cleared
+#endif
+  uint8_t tchannel; // RT A/B flag and group version, on change the buffer is cleared
+#if RDS_ENABLED(1,0)
+  uint8_t ecc;      // extended country code, 0 if not received
+#endif
+#if RDS_ENABLED(10,0)
+  char ptyn[9];     // program type name given by station
+  uint8_t ptyn_ab;  // A/B flag of ptyn, on change the name is cleared
+#endif
+#ifdef RDSSTATS
+  uint16_t clock;   // ticks since reset
+  RDSStats stats;
+#endif
+#ifdef TMC
+  TMCStore *tmc;    // traffic messages, kept over retunes
+#endif
 public:
+  uint16_t get_pi() { return pi; }
+  int8_t get_pty() { return pty; } // -1 until first group is received
   const char *get_ps() { return ps; }
   const char *get_rt() { return rt; }
+#if RDS_ENABLED(4,0)
   const char *get_date() { return date; }
   const char *get_time() { return time; }
+#endif
+#if RDS_ENABLED(1,0)
+  uint8_t get_ecc() { return ecc; }
+#endif
+#if RDS_ENABLED(10,0)
+  const char *get_station_ptyn() { return ptyn; }
+#endif
+#ifdef RTPLUS
+  // RT+ item title and artist as offset and length in radio text,
+  // returns 0 if not known for current text
+  uint8_t get_title(uint8_t *start,uint8_t *len) { return get_tag(0,start,len); }
+  uint8_t get_artist(uint8_t *start,uint8_t *len) { return get_tag(1,start,len); }
+  uint8_t get_tag(uint8_t i,uint8_t *start,uint8_t *len)
+  {
+    *start=rtp_start[i];
+    *len=rtp_len[i];
+    return *len!=0;
+  }
+#endif
 #ifdef PROGRAMTYPENAMES
   const char *get_ptyn() { return (pty>=0)?_program_types[pty]:_program_types[0]; } 
 #else
@@ -63,24 +223,104 @@ public:
 
   void decode_group(uint16_t b1,uint16_t b2,uint16_t b3,uint16_t b4);
 
+  // preload station name seen earlier on the same channel. the name
+  // is kept if first received group carries the same PI, otherwise
+  // it is dropped
+  void prime(uint16_t p,const char *name)
+  {
+    reset();
+    memcpy(ps,name,sizeof(ps)-1);
+    pi=p;
+    primed=1;
+  }
+
+  // advance decoder clock, to be called on every tick
+  void tick()
+  {
+    RDSSTAT(clock++);
+  }
+
+  // radio driver found that a group was received without seeing
+  // a new RDS ready edge
+  void missed_group()
+  {
+    RDSSTAT(stats.missed++);
+  }
+
+#ifdef RDSSTATS
+  const RDSStats *get_stats() { return &stats; }
+#endif
+
+#ifdef TMC
+  void set_tmc(TMCStore *t) { tmc=t; }
+#endif
+
   void reset()
   {
+    pi=0;
+    candidate_pi=0;
+    primed=0;
+    ps_seen=0;
+#ifdef RDSSTATS
+    clock=0;
+    memset(&stats,0,sizeof(stats));
+#endif
     memset(ps,0,sizeof(ps));
     memset(rt,0,sizeof(rt));
     memset(rtbuf,0,sizeof(rtbuf));
+    memset(psbuf,0,sizeof(psbuf));
+    rt_seen=0;
+    rt_last=15;
     pty=-1;
+#if RDS_ENABLED(4,0)
     memset(time,0,sizeof(time));
     memset(date,0,sizeof(date));
+#endif
     tchannel=0;
+    memset(oda,0,sizeof(oda));
+#if RDS_ENABLED(1,0)
+    ecc=0;
+#endif
+#if RDS_ENABLED(10,0)
+    memset(ptyn,0,sizeof(ptyn));
+    ptyn_ab=0;
+#endif
+#ifdef RTPLUS
+    memset(rtp_len,0,sizeof(rtp_len));
+    rtp_toggle=0;
+#endif
   }    
   
   RDSDecoder()
   {
+#ifdef TMC
+    tmc=NULL;
+#endif
     reset(); 
   }
   
 };
 
+#define ANY_AGE 0xffff       // status getters never read the chip
+
+#define RADIO_TUNED 0x01     // run() result flags, tune or seek completed
+#define RADIO_GROUP 0x02     // RDS group decoded
+#define RADIO_FAILED 0x04    // with RADIO_TUNED, tune or seek timed out
+
+#define I2C_SPEED 400000L   // fast mode, TWBR=2 at 8MHz
+// TWINT polling loops before a transfer is considered stuck. a byte takes
+// 180 cycles at 400kHz, this allows for about 1ms of clock stretching
+#define I2C_TIMEOUT 1600
+
+// bus error counters, these only ever increase
+struct I2CErrors
+{
+  uint16_t timeouts;     // TWINT not set in time, bus was recovered
+  uint16_t naks;         // address or data not acknowledged
+  uint16_t arbitration;  // lost arbitration, bus noise
+  uint16_t recoveries;   // bus clear sequences
+};
+
 // base class for radio modules
 // defines interface and implements common functionality such as i2c
 // protocol
@@ -88,35 +328,99 @@ public:
 class BaseRadio
 {
 protected:
-  RDSDecoder *decoder;
+  RDSReceiver *decoder;
+  I2CErrors i2c_errors;
 
+  uint8_t i2c_wait();
+  void i2c_recover();
+  void i2c_error(uint8_t status);
   void i2c_stop();
   bool i2c_start();
   uint8_t i2c_send(uint8_t *buf,uint8_t count);
   uint8_t i2c_recv(uint8_t *buf,uint8_t count);
-  uint8_t i2c_write(uint8_t slave,uint8_t *buf,uint8_t count);
-  uint8_t i2c_read(uint8_t slave,uint8_t *buf,uint8_t count);
+  // transfers return number of bytes transferred. virtual, so that
+  // a radio can be driven on another bus, see softi2c.hpp
+  virtual uint8_t i2c_write(uint8_t slave,uint8_t *buf,uint8_t count);
+  virtual uint8_t i2c_read(uint8_t slave,uint8_t *buf,uint8_t count);
+
+  // low priority transfer for other devices on the TWI bus
+  uint8_t *post_buf;
+  uint8_t post_slave;
+  uint8_t post_count;    // 0 when nothing is posted
+  uint8_t post_failed;   // last posted write was not completed
+
+  // nonzero when the radio will use the bus within next tick
+  virtual uint8_t bus_wanted(uint16_t now) { return 0; }
 
 public:
+  // set bus clock, call once before first transfer
+  void i2c_init(uint32_t speed=I2C_SPEED);
+  const I2CErrors* get_i2c_errors() { return &i2c_errors; }
+
+  // bus arbiter for other devices on the TWI bus, such as display.
+  // radio transfers have priority, they are done when needed. a posted
+  // write waits until i2c_idle() is called in a tick when bus_wanted()
+  // is 0, so that a slow or stuck transfer to other device never delays
+  // an RDS poll or tune. one write can be posted, posting again replaces
+  // it, and buf must stay unchanged until sent. a failed write is not
+  // retried here, it is counted in I2CErrors and i2c_post_failed()
+  // tells the poster
+  void i2c_post(uint8_t slave,uint8_t *buf,uint8_t count)
+  {
+    post_slave=slave;
+    post_buf=buf;
+    post_count=count;
+  }
+  uint8_t i2c_posted() { return post_count; }
+  // call once per tick, after the radio has done its work
+  void i2c_idle(uint16_t now)
+  {
+    if (post_count && !bus_wanted(now)) {
+      if (BaseRadio::i2c_write(post_slave,post_buf,post_count)!=post_count)
+        post_failed=1;
+      post_count=0;
+    }
+  }
+  // nonzero once after a posted write failed
+  uint8_t i2c_post_failed()
+  {
+    uint8_t f=post_failed;
+    post_failed=0;
+    return f;
+  }
+  // immediate write to other device, for setup before the main loop
+  uint8_t i2c_command(uint8_t slave,uint8_t *buf,uint8_t count)
+  {
+    return BaseRadio::i2c_write(slave,buf,count);
+  }
+
   virtual const char* name() = 0;
   virtual void init() = 0;
+  virtual uint8_t boot(uint16_t now) { return 1; }
   virtual void set_frequency(int32_t f) = 0;
-  virtual int32_t get_frequency() = 0;
-  virtual uint8_t is_tuned() = 0;
-  virtual uint8_t is_stereo() = 0;
+  virtual int32_t get_frequency(uint16_t now=0,uint16_t maxage=ANY_AGE) = 0;
+  virtual void set_channel(uint16_t channel) = 0;
+  virtual uint16_t get_channel(uint16_t now=0,uint16_t maxage=ANY_AGE) = 0;
+  virtual uint16_t get_max_channel() = 0;
+  virtual uint8_t is_tuned(uint16_t now=0,uint16_t maxage=ANY_AGE) = 0;
+  virtual uint8_t is_stereo(uint16_t now=0,uint16_t maxage=ANY_AGE) = 0;
   virtual uint8_t is_connected() = 0;
-  virtual int32_t get_min_frequency() { return 8700; }
-  virtual int32_t get_max_frequency() { return 10800; }
-  virtual uint8_t get_rssi() { return 0; }
+  virtual int32_t get_min_frequency() { return region.min_frequency; }
+  virtual int32_t get_max_frequency() { return region.max_frequency; }
+  virtual uint8_t get_rssi(uint16_t now=0,uint16_t maxage=ANY_AGE) { return 0; }
+  virtual uint8_t get_generation() { return 0; }
   virtual void set_mono(uint8_t onoff) { }
   virtual void set_soft_mute(uint8_t onoff) { }
   virtual void sleep() { }
   virtual void wakeup() { }
-  virtual void run() { }
-  virtual void set_decoder(RDSDecoder *d) { decoder=d; }
+  virtual uint8_t run(uint16_t now) { return 0; }
+  virtual void set_decoder(RDSReceiver *d) { decoder=d; }
+  virtual void begin() { }
+  virtual void commit() { }
+  virtual uint8_t is_tuning() { return 0; }
   virtual void seek_up() { };
   virtual void seek_down() { };
-  BaseRadio() : decoder(NULL) { }
+  BaseRadio() : decoder(NULL), post_count(0), post_failed(0) { memset(&i2c_errors,0,sizeof(i2c_errors)); }
 };
 
 #endif
@@ -0,0 +1,614 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// whole firmware benchmark. runs the unmodified silicon_radio.elf in
+// simavr as ATmega168 at 8MHz, with models of the Si4703 on TWI and
+// the DL2416 display on the ports, and reports for each scenario
+//
+//   cycles    simulated CPU cycles of the scenario
+//   busy      percentage of cycles the CPU was not sleeping
+//   twi       TWI bytes per second of simulated time
+//   lat       TIMER0_OVF interrupt latency, max and average cycles
+//   isr       worst interrupt latency of any vector, cycles
+//   disp      characters written to display
+//
+// a second Si4703 model is on the bit-banged bus of PB6/PB7, for
+// firmware built with SCANNER
+//
+// scenarios run one after another on the same firmware instance
+//
+//   boot      reset to audio on, that is tune complete with volume set
+//   rtscroll  RDS on, until the end of radio text has scrolled to display
+//   encoder   50 encoder detents clockwise
+//   idle      one minute on a station with RDS
+//   scan      background scanner over the band, until it has made a full
+//             pass, the tuner playing must see no tune or seek
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_time.h"
+#include "sim_cycle_timers.h"
+#include "sim_interrupts.h"
+#include "avr_ioport.h"
+#include "avr_twi.h"
+
+#define F_CPU 8000000
+#define SI4703_ADDR (0x10<<1)
+#define TUNE_USEC 60000        // Si4703 tune time
+#define SEEK_USEC 250000       // seek time to next station
+#define GROUP_USEC 87579       // RDS group, 104 bits at 1187.5bps
+#define RDSR_USEC 40000        // RDSR high time after group
+#define PHASE_USEC 40000       // encoder phase time, two phases per detent
+#define TIMER0_VECTOR 16
+
+// Si4703 registers
+enum {
+  POWERCFG=2, CHANNEL=3, SYSCONFIG2=5, STATUSRSSI=10, READCHAN=11,
+  RDSA=12, RDSB=13, RDSC=14, RDSD=15
+};
+#define RDSR 0x8000
+#define STC 0x4000
+#define ST 0x0100
+#define TUNE 0x8000
+#define SEEK 0x0100
+#define RSSI 42
+
+static const char ps_text[]="BENCH FM";
+static const char rt_text[]=
+  "SIMULATED RADIO TEXT FOR BENCHMARK, SCROLLING ON BUBBLE DISPLAY.";
+
+typedef struct si4703_t {
+  avr_t *avr;
+  avr_irq_t *irq;
+  uint16_t reg[16];
+  uint8_t selected;  // address byte, 0 when not addressed
+  uint8_t pos;       // byte position in transfer
+  uint8_t hi;        // high byte of register being written
+  int rds;           // send RDS groups
+  int group;         // next group in script
+  uint32_t bytes;    // bytes transferred
+  uint32_t tunes;    // tunes and seeks started
+  uint32_t wraps;    // seeks that wrapped from band end to start
+  avr_cycle_count_t audio; // cycle when audio came on
+} si4703_t;
+
+// bit level I2C slave, lines are driven open drain by DDRB
+typedef struct softbus_t {
+  avr_t *avr;
+  si4703_t *si;
+  int scl,sda;       // line levels
+  int state;
+  int bit;           // bit of byte, 8 is acknowledge, -1 after start
+  uint8_t byte;
+  int drive;         // slave pulls SDA low
+} softbus_t;
+
+enum { BUS_IDLE, BUS_ADDR, BUS_WRITE, BUS_READ_START, BUS_READ, BUS_IGNORE };
+#define SOFT_SCL 0x40
+#define SOFT_SDA 0x80
+
+typedef struct dl2416_t {
+  avr_t *avr;
+  char text[9];
+  uint8_t portd;
+  uint32_t writes;
+} dl2416_t;
+
+typedef struct stats_t {
+  avr_cycle_count_t start;
+  avr_cycle_count_t sleep;
+  uint32_t twi;
+  uint32_t disp;
+  uint32_t t0count;
+  uint64_t t0total;
+  uint32_t t0max;
+  uint32_t isrmax;
+} stats_t;
+
+static si4703_t si;
+static si4703_t si2;
+static softbus_t sb;
+static dl2416_t dl;
+static stats_t st;
+static avr_cycle_count_t pending[32];
+static int encoder_steps,encoder_state=3;
+
+// Si4703 model
+
+static void si_status(si4703_t *p,uint16_t set,uint16_t clear)
+{
+  p->reg[STATUSRSSI]=(p->reg[STATUSRSSI]&~clear)|set;
+}
+
+static avr_cycle_count_t si_tune_done(avr_t *avr,avr_cycle_count_t when,void *param)
+{
+  si4703_t *p=param;
+  p->reg[READCHAN]=p->reg[CHANNEL]&0x3ff;
+  si_status(p,STC|ST|RSSI,0);
+  return 0;
+}
+
+static avr_cycle_count_t si_seek_done(avr_t *avr,avr_cycle_count_t when,void *param)
+{
+  si4703_t *p=param;
+  uint16_t c=((p->reg[READCHAN]/10)+1)*10%200;
+  // stations every 1MHz
+  if (c<p->reg[READCHAN])
+    p->wraps++;
+  p->reg[CHANNEL]=(p->reg[CHANNEL]&~0x3ff)|c;
+  return si_tune_done(avr,when,param);
+}
+
+static avr_cycle_count_t si_rdsr_off(avr_t *avr,avr_cycle_count_t when,void *param)
+{
+  si_status(param,0,RDSR);
+  return 0;
+}
+
+// group script: 4 0A groups with station name, then 16 2A groups
+// with radio text
+static avr_cycle_count_t si_group(avr_t *avr,avr_cycle_count_t when,void *param)
+{
+  si4703_t *p=param;
+  int g=p->group++%20;
+  if (p->rds && (p->reg[STATUSRSSI]&STC)==0 && !(p->reg[CHANNEL]&TUNE) &&
+    !(p->reg[POWERCFG]&SEEK)) {
+    p->reg[RDSA]=0x5201;
+    if (g<4) {
+      p->reg[RDSB]=0x0000|(10<<5)|g;
+      p->reg[RDSC]=0xe0cd;
+      p->reg[RDSD]=(ps_text[g*2]<<8)|ps_text[g*2+1];
+    }
+    else {
+      g-=4;
+      p->reg[RDSB]=0x2000|(10<<5)|g;
+      p->reg[RDSC]=(rt_text[g*4]<<8)|rt_text[g*4+1];
+      p->reg[RDSD]=(rt_text[g*4+2]<<8)|rt_text[g*4+3];
+    }
+    si_status(p,RDSR,0);
+    avr_cycle_timer_register_usec(avr,RDSR_USEC,si_rdsr_off,p);
+  }
+  return when+avr_usec_to_cycles(avr,GROUP_USEC);
+}
+
+static void si_written(si4703_t *p,int r,uint16_t v)
+{
+  uint16_t old=p->reg[r];
+  p->reg[r]=v;
+  if (r==CHANNEL) {
+    if ((v&TUNE) && !(old&TUNE)) {
+      avr_cycle_timer_register_usec(p->avr,TUNE_USEC,si_tune_done,p);
+      p->tunes++;
+    }
+    if (!(v&TUNE) && (old&TUNE)) {
+      si_status(p,0,STC);
+      if ((p->reg[SYSCONFIG2]&0x0f) && !p->audio)
+        p->audio=p->avr->cycle;
+    }
+  }
+  if (r==POWERCFG) {
+    if ((v&SEEK) && !(old&SEEK)) {
+      avr_cycle_timer_register_usec(p->avr,SEEK_USEC,si_seek_done,p);
+      p->tunes++;
+    }
+    if (!(v&SEEK) && (old&SEEK))
+      si_status(p,0,STC);
+  }
+}
+
+// address byte after start, returns 1 if it is ours
+static int si_address(si4703_t *p,uint8_t addr)
+{
+  p->selected=0;
+  p->pos=0;
+  if ((addr&0xfe)==SI4703_ADDR)
+    p->selected=addr;
+  return p->selected!=0;
+}
+
+// writes start from register 2
+static void si_put(si4703_t *p,uint8_t data)
+{
+  int r=(2+p->pos/2)&15;
+  if (p->pos&1)
+    si_written(p,r,(p->hi<<8)|data);
+  else
+    p->hi=data;
+  p->pos++;
+  p->bytes++;
+}
+
+// reads start from register 10
+static uint8_t si_get(si4703_t *p)
+{
+  int r=(10+p->pos/2)&15;
+  uint8_t c=(p->pos&1)?p->reg[r]&0xff:p->reg[r]>>8;
+  p->pos++;
+  p->bytes++;
+  return c;
+}
+
+static void si_twi_hook(struct avr_irq_t *irq,uint32_t value,void *param)
+{
+  si4703_t *p=param;
+  avr_twi_msg_irq_t v;
+  v.u.v=value;
+  if (v.u.twi.msg&TWI_COND_STOP)
+    p->selected=0;
+  if (v.u.twi.msg&TWI_COND_START) {
+    if (si_address(p,v.u.twi.addr))
+      avr_raise_irq(p->irq+TWI_IRQ_INPUT,avr_twi_irq_msg(TWI_COND_ACK,p->selected,1));
+  }
+  if (!p->selected)
+    return;
+  if (v.u.twi.msg&TWI_COND_WRITE) {
+    avr_raise_irq(p->irq+TWI_IRQ_INPUT,avr_twi_irq_msg(TWI_COND_ACK,p->selected,1));
+    si_put(p,v.u.twi.data);
+  }
+  if (v.u.twi.msg&TWI_COND_READ)
+    avr_raise_irq(p->irq+TWI_IRQ_INPUT,avr_twi_irq_msg(TWI_COND_READ,p->selected,
+      si_get(p)));
+}
+
+static const char *si_irq_names[2]={
+  [TWI_IRQ_INPUT]="8>si4703.out",
+  [TWI_IRQ_OUTPUT]="32<si4703.in",
+};
+
+static void si_model_init(avr_t *avr,si4703_t *p)
+{
+  memset(p,0,sizeof(*p));
+  p->avr=avr;
+  p->reg[0]=0x1242;          // device id
+  p->reg[1]=0x1253;          // chip id, rev C
+  p->rds=1;
+  avr_cycle_timer_register_usec(avr,GROUP_USEC,si_group,p);
+}
+
+static void si_init(avr_t *avr,si4703_t *p)
+{
+  si_model_init(avr,p);
+  p->irq=avr_alloc_irq(&avr->irq_pool,0,2,si_irq_names);
+  avr_irq_register_notify(p->irq+TWI_IRQ_OUTPUT,si_twi_hook,p);
+  avr_connect_irq(p->irq+TWI_IRQ_INPUT,
+    avr_io_getirq(avr,AVR_IOCTL_TWI_GETIRQ(0),TWI_IRQ_INPUT));
+  avr_connect_irq(avr_io_getirq(avr,AVR_IOCTL_TWI_GETIRQ(0),TWI_IRQ_OUTPUT),
+    p->irq+TWI_IRQ_OUTPUT);
+}
+
+// bit level slave. data bits are sampled on SCL rising edge, and
+// the slave changes SDA after SCL falling edge
+
+static void sb_lines(softbus_t *b)
+{
+  avr_raise_irq(avr_io_getirq(b->avr,AVR_IOCTL_IOPORT_GETIRQ('B'),6),b->scl);
+  avr_raise_irq(avr_io_getirq(b->avr,AVR_IOCTL_IOPORT_GETIRQ('B'),7),b->sda);
+}
+
+static void sb_falling(softbus_t *b)
+{
+  b->bit++;
+  switch (b->state) {
+    case BUS_ADDR:
+    case BUS_WRITE:
+      if (b->bit==8) {
+        if (b->state==BUS_WRITE)
+          si_put(b->si,b->byte);
+        else if (si_address(b->si,b->byte))
+          b->state=(b->byte&1)?BUS_READ_START:BUS_WRITE;
+        else {
+          b->state=BUS_IGNORE;
+          break;
+        }
+        b->drive=1;
+      }
+      else if (b->bit==9) {
+        b->bit=0;
+        b->byte=0;
+        b->drive=0;
+      }
+      break;
+    case BUS_READ_START:  // address acknowledged, first byte out
+      if (b->bit<9)
+        break;
+      b->state=BUS_READ;
+    case BUS_READ:
+      if (b->bit==9) {
+        b->bit=0;
+        b->byte=si_get(b->si);
+      }
+      if (b->bit<8)
+        b->drive=!((b->byte<<b->bit)&0x80);
+      else
+        b->drive=0;     // master acknowledges
+      break;
+  }
+}
+
+static void sb_ddr_hook(struct avr_irq_t *irq,uint32_t value,void *param)
+{
+  softbus_t *b=param;
+  int scl=!(value&SOFT_SCL),msda=!(value&SOFT_SDA);
+  int sda=msda && !b->drive;
+  if (b->scl && scl && sda!=b->sda) {
+    if (!sda) {         // start, first SCL fall starts bit 0
+      b->state=BUS_ADDR;
+      b->bit=-1;
+      b->byte=0;
+    }
+    else                // stop
+      b->state=BUS_IDLE;
+    b->drive=0;
+  }
+  else if (!b->scl && scl) {
+    if (b->bit<8 && (b->state==BUS_ADDR || b->state==BUS_WRITE))
+      b->byte=(b->byte<<1)|sda;
+    if (b->bit==8 && b->state==BUS_READ && msda)
+      b->state=BUS_IGNORE; // master did not acknowledge, wait for stop
+  }
+  else if (b->scl && !scl && b->state!=BUS_IDLE && b->state!=BUS_IGNORE)
+    sb_falling(b);
+  b->scl=scl;
+  b->sda=msda && !b->drive;
+  sb_lines(b);
+}
+
+static void sb_init(avr_t *avr,softbus_t *b,si4703_t *p)
+{
+  memset(b,0,sizeof(*b));
+  b->avr=avr;
+  b->si=p;
+  b->scl=b->sda=1;
+  sb_lines(b);
+  avr_irq_register_notify(avr_io_getirq(avr,AVR_IOCTL_IOPORT_GETIRQ('B'),
+    IOPORT_IRQ_DIRECTION_ALL),sb_ddr_hook,b);
+}
+
+// DL2416 model. data and WR on port D, address and chip selects on
+// port B. character is latched on rising edge of WR
+
+static void dl_portd_hook(struct avr_irq_t *irq,uint32_t value,void *param)
+{
+  dl2416_t *p=param;
+  uint8_t pb=p->avr->data[0x25]; // PORTB
+  int pos;
+  if ((value&0x80) && !(p->portd&0x80) && (pb&0x0c)!=0x0c) {
+    pos=3-(pb&3);
+    if (!(pb&0x08))
+      pos+=4;
+    p->text[pos]=value&0x7f;
+    p->writes++;
+  }
+  p->portd=value;
+}
+
+static void dl_init(avr_t *avr,dl2416_t *p)
+{
+  memset(p,0,sizeof(*p));
+  memset(p->text,' ',8);
+  p->avr=avr;
+  p->portd=0x80;
+  avr_irq_register_notify(avr_io_getirq(avr,AVR_IOCTL_IOPORT_GETIRQ('D'),
+    IOPORT_IRQ_PIN_ALL),dl_portd_hook,p);
+}
+
+// inputs
+
+static void pin(avr_t *avr,char port,int bit,int level)
+{
+  avr_raise_irq(avr_io_getirq(avr,AVR_IOCTL_IOPORT_GETIRQ(port),bit),level);
+}
+
+// one encoder phase, gray code 3,1,0,2 clockwise
+static avr_cycle_count_t encoder_phase(avr_t *avr,avr_cycle_count_t when,void *param)
+{
+  static const uint8_t next[4]={2,0,3,1};
+  if (!encoder_steps)
+    return 0;
+  encoder_state=next[encoder_state];
+  pin(avr,'B',4,encoder_state&1);
+  pin(avr,'B',5,encoder_state>>1);
+  encoder_steps--;
+  return when+avr_usec_to_cycles(avr,PHASE_USEC);
+}
+
+// interrupt latency, from vector pending to handler start
+
+static void int_pending(struct avr_irq_t *irq,uint32_t value,void *param)
+{
+  if (value)
+    pending[(intptr_t)param]=si.avr->cycle;
+}
+
+static void int_running(struct avr_irq_t *irq,uint32_t value,void *param)
+{
+  int v=(intptr_t)param;
+  uint32_t lat;
+  if (!value || !pending[v])
+    return;
+  lat=si.avr->cycle-pending[v];
+  pending[v]=0;
+  if (lat>st.isrmax)
+    st.isrmax=lat;
+  if (v==TIMER0_VECTOR) {
+    st.t0count++;
+    st.t0total+=lat;
+    if (lat>st.t0max)
+      st.t0max=lat;
+  }
+}
+
+static void int_init(avr_t *avr)
+{
+  intptr_t v;
+  avr_irq_t *irq;
+  for (v=1;v<26;v++) {
+    irq=avr_get_interrupt_irq(avr,v);
+    if (!irq)
+      continue;
+    avr_irq_register_notify(irq+AVR_INT_IRQ_PENDING,int_pending,(void*)v);
+    avr_irq_register_notify(irq+AVR_INT_IRQ_RUNNING,int_running,(void*)v);
+  }
+}
+
+// scenario runner
+
+typedef int (*done_t)(avr_t *avr);
+
+static void begin(avr_t *avr)
+{
+  memset(&st,0,sizeof(st));
+  st.start=avr->cycle;
+  st.twi=si.bytes;
+  st.disp=dl.writes;
+}
+
+// run until done() returns true or timeout, returns 0 on timeout
+static int run(avr_t *avr,uint32_t usec,done_t done)
+{
+  avr_cycle_count_t end=avr->cycle+avr_usec_to_cycles(avr,usec),c;
+  int state=cpu_Running,sleeping;
+  while (avr->cycle<end) {
+    if (done && done(avr))
+      return 1;
+    c=avr->cycle;
+    sleeping=(avr->state==cpu_Sleeping);
+    state=avr_run(avr);
+    if (sleeping)
+      st.sleep+=avr->cycle-c;
+    if (state==cpu_Done || state==cpu_Crashed) {
+      fprintf(stderr,"firmware stopped at cycle %llu\n",(unsigned long long)avr->cycle);
+      exit(1);
+    }
+  }
+  return done==NULL;
+}
+
+static void report(avr_t *avr,const char *name,int ok)
+{
+  avr_cycle_count_t cycles=avr->cycle-st.start;
+  double secs=(double)cycles/F_CPU;
+  printf("%-9s %s cycles=%-10llu busy=%5.2f%% twi=%6.0fB/s lat=%u/%.1f isr=%u disp=%u\n",
+    name,ok?"ok     ":"TIMEOUT",(unsigned long long)cycles,
+    100.0*(cycles-st.sleep)/cycles,(si.bytes-st.twi)/secs,
+    st.t0max,st.t0count?(double)st.t0total/st.t0count:0.0,st.isrmax,
+    dl.writes-st.disp);
+}
+
+static int audio_on(avr_t *avr)
+{
+  return si.audio!=0;
+}
+
+// last 8 characters of radio text on display
+static int rt_end(avr_t *avr)
+{
+  return memcmp(dl.text,rt_text+sizeof(rt_text)-9,8)==0;
+}
+
+static int encoder_done(avr_t *avr)
+{
+  return encoder_steps==0;
+}
+
+// the scan starts anywhere in the band, so the pass up to the first
+// wrap is partial, and the second wrap ends the first full pass
+static uint32_t scan_start,scan_wraps;
+
+static int scan_pass(avr_t *avr)
+{
+  return si2.wraps-scan_wraps>=2;
+}
+
+int main(int argc,char *argv[])
+{
+  elf_firmware_t f;
+  avr_t *avr;
+  int ok;
+  uint32_t fg_tunes;
+  if (argc<2) {
+    fprintf(stderr,"usage: sibench silicon_radio.elf\n");
+    return 1;
+  }
+  memset(&f,0,sizeof(f));
+  if (elf_read_firmware(argv[1],&f)) {
+    fprintf(stderr,"can not read %s\n",argv[1]);
+    return 1;
+  }
+  avr=avr_make_mcu_by_name("atmega168");
+  if (!avr) {
+    fprintf(stderr,"simavr has no atmega168\n");
+    return 1;
+  }
+  avr_init(avr);
+  avr->frequency=F_CPU;
+  avr_load_firmware(avr,&f);
+  si_init(avr,&si);
+  si_model_init(avr,&si2);
+  sb_init(avr,&sb,&si2);
+  dl_init(avr,&dl);
+  int_init(avr);
+  pin(avr,'C',0,0);   // power switch on
+  pin(avr,'C',2,1);   // button up
+  pin(avr,'B',4,1);   // encoder at rest
+  pin(avr,'B',5,1);
+
+  begin(avr);
+  ok=run(avr,5000000,audio_on);
+  report(avr,"boot",ok);
+
+  begin(avr);
+  ok=run(avr,30000000,rt_end);
+  report(avr,"rtscroll",ok);
+
+  begin(avr);
+  encoder_steps=100;
+  avr_cycle_timer_register_usec(avr,PHASE_USEC,encoder_phase,NULL);
+  ok=run(avr,20000000,encoder_done);
+  run(avr,500000,NULL); // let the last tune complete
+  report(avr,"encoder",ok);
+
+  begin(avr);
+  ok=run(avr,60000000,NULL);
+  report(avr,"idle",ok);
+
+  begin(avr);
+  scan_start=si2.tunes;
+  scan_wraps=si2.wraps;
+  fg_tunes=si.tunes;
+  if (si2.bytes) {
+    ok=run(avr,30000000,scan_pass);
+    report(avr,"scan",ok && si.tunes==fg_tunes);
+    printf("          scanner seeks=%u softbus=%uB tuner tunes=%u\n",
+      si2.tunes-scan_start,si2.bytes,si.tunes-fg_tunes);
+  }
+  else
+    printf("scan      firmware built without SCANNER\n");
+  return 0;
+}
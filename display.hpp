@@ -26,14 +26,40 @@ SOFTWARE.
 #include <avr/io.h>
 #include <util/delay.h>
 #include <string.h>
+#include <util/atomic.h>
+#include "telemetry.hpp"
+#ifdef DISPLAY_HT16K33
+#include "ht16k33.hpp"
+#endif
+
+#define DISPLAY_BURST_COUNTS 80  // Timer1 counts a full 8 character burst may take
 
 // display class for dual bubble display, with scrolling text support
 //
+// with DISPLAY_HT16K33 the characters go to a 14 segment display on
+// the TWI bus instead, see ht16k33.hpp. text handling is the same
+//
+// display address line A1 is on PB1, which is also the meter PWM output
+// OC1A. while the meter timer runs, refresh() only updates the frame,
+// and the changed characters are written out in one burst from Timer1
+// compare match interrupt. at that point OC1A is low until the end of
+// PWM cycle, so disconnecting it for the burst does not change the
+// meter duty cycle, as long as the burst ends before TOP. the bursts
+// and the PWM counts lost past TOP are counted
+//
 class Display
 {
   char buf[65];  // this is string currently displayed, so that scrolling can happen
   uint8_t cp;    // next character address in buf
   uint8_t fofs;  // visible frame offset
+  char frame[8]; // characters to show
+#ifdef DISPLAY_HT16K33
+  HT16K33 chip;
+#else
+  char shown[8]; // characters on display
+  volatile uint8_t dirty; // frame differs from shown
+  uint16_t bursts;        // frames written from interrupt
+  uint16_t lost;          // PWM counts OC1A was disconnected past TOP
   
   // write single character at adr, starting from left
   void write(uint8_t adr,uint8_t data)
@@ -52,26 +78,128 @@ class Display
     PORTD=data|0x80;           // WR high
     PORTB|=0x0c;               // both CS high
   }
-  
+
+  // write changed characters of frame
+  void flush()
+  {
+    uint8_t i;
+    for (i=0;i<8;i++) {
+      if (frame[i]!=shown[i]) {
+        write(i,frame[i]);
+        shown[i]=frame[i];
+      }
+    }
+    dirty=0;
+  }
+#endif
+
 public:
 
+#ifdef DISPLAY_HT16K33
   Display()
   {
     clear();
   }
 
-  // show a single frame from current offset
+  // start the display chip, call after bus is initialized
+  void attach(BaseRadio *bus)
+  {
+    chip.attach(bus);
+    refresh();
+  }
+
+  // show a single frame from current offset. the changed digits are
+  // posted to the bus arbiter, and written out from BaseRadio::i2c_idle()
   void refresh(void)
   {
-    int8_t i;
+    uint8_t i;
     for (i=0;(i+fofs)<cp && i<8;i++)
-      write(i,buf[i+fofs]);
-    while (i<8) {
-      write(i,' ');
-      i++;
+      frame[i]=buf[i+fofs];
+    while (i<8)
+      frame[i++]=' ';
+    chip.show(frame);
+  }
+
+  // send again digits of a failed write, call on every tick after
+  // BaseRadio::i2c_idle()
+  void run()
+  {
+    if (chip.check())
+      refresh();
+  }
+
+  void isr() { }
+  uint16_t get_bursts() { return 0; }
+  uint16_t get_lost() { return 0; }
+#else
+  Display() : bursts(0), lost(0)
+  {
+    clear();
+  }
+
+  // show a single frame from current offset
+  void refresh(void)
+  {
+    uint8_t i;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      for (i=0;(i+fofs)<cp && i<8;i++)
+        frame[i]=buf[i+fofs];
+      while (i<8)
+        frame[i++]=' ';
+      if (memcmp(frame,shown,sizeof(frame))) {
+        dirty=1;
+        if (TCCR1B&7) {            // meter running, write from interrupt
+          if (!(TIMSK1&(1<<OCIE1A))) {
+            TIFR1=(1<<OCF1A);      // next compare match, not an old one
+            TIMSK1|=(1<<OCIE1A);
+          }
+          return;
+        }
+        TIMSK1&=~(1<<OCIE1A);
+      }
     }
+    if (!dirty)
+      return;
+#ifdef TELEMETRY
+    Telemetry::release(); // D0 and D1 are shared with USART
+#endif
+    flush();
+#ifdef TELEMETRY
+    Telemetry::claim();
+#endif
   }
 
+  // write frame while OC1A is low, called from Timer1 compare
+  // match interrupt. if there is not enough time left in PWM cycle,
+  // or telemetry is still sending, then the next cycle is tried
+  void isr()
+  {
+    uint16_t start=TCNT1,end;
+    if (start>ICR1-DISPLAY_BURST_COUNTS)
+      return;
+#ifdef TELEMETRY
+    if (!Telemetry::try_release())
+      return;
+#endif
+    TCCR1A&=~(1<<COM1A1);      // PB1 to PORTB control
+    flush();
+    end=TCNT1;
+    TCCR1A|=(1<<COM1A1);
+#ifdef TELEMETRY
+    Telemetry::claim();
+#endif
+    TIMSK1&=~(1<<OCIE1A);
+    bursts++;
+    if (end<start)             // ran past TOP into high part of cycle
+      lost+=(end<OCR1A)?end:OCR1A;
+  }
+
+  void run() { }
+  uint16_t get_bursts() { return bursts; }
+  uint16_t get_lost() { return lost; }
+#endif
+
   // advance visible frame by one character and update display
   // returns 1 if frame wrapped back to beginning, 0 if more
   // text to show
@@ -91,11 +219,15 @@ public:
   void clear(void)
   {
     memset(buf,'\0',sizeof(buf));
+#ifdef DISPLAY_HT16K33
+    chip.invalidate();
+#else
+    memset(shown,'\0',sizeof(shown)); // force all characters out
+#endif
     cp=0;
     fofs=0;
     refresh();
   }
-  
   // write a character to display buffer at current
   // cursor position. the display is not refreshed
   void putc(char c)
@@ -107,43 +239,22 @@ public:
         buf[i]=buf[i+1];
       cp=i;
     }      
-    if (c>='a' && c<='z')
-      c=c-('a'-'A');
     buf[cp++]=c;
     buf[cp]='\0';
   }
 
   // put a string to display buffer, visible frame to beginning,
-  // and refresh display
+  // and refresh display. strings must be in display character set,
+  // RDS text is translated by decoder
   void puts(const char* s)
   {
-    char c;
     cp=0;
     while (s && *s && cp<sizeof(buf)-1)
-    {
-      c=*s++;
-      if (c>='a' && c<='z')
-        c=c-('a'-'A');
-      buf[cp++]=c;
-    }
+      buf[cp++]=*s++;
     buf[cp]='\0';
     fofs=0;
     refresh();
   }
 
-  // print 32 bit decimal number at cursor position
-  // and refresh display
-  void putn(int32_t n)
-  {
-    if (n<0) {
-      putc('-');
-      n=0-n;
-    }
-    if (n>9)
-      putn(n/10);
-    putc((n%10)+'0');
-    refresh();
-  }
-
 };
 #endif
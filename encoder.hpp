@@ -28,26 +28,56 @@ SOFTWARE.
 #define BUTTON_STATUS()  ((PINC>>2)&1)
 #define ENCODER_INPUTS() ((PINB>>4)&0x03)
 
+#define LONG_PRESS_TICKS 500 // about 1 second
+
+enum BUTTON_EVENTS { NO_PRESS, SHORT_PRESS, LONG_PRESS };
+
 // this is rotary encoder input functionality for Alps STEC11,STEC12 family
 // and others that have a pushbutton function on a shaft as well.
 //
 class Encoder
 {
+  uint8_t b;      // button debounce shift register
+  uint16_t held;  // ticks button has been down
 public:
 
-  // debounce and read button presses
+  Encoder() : b(0xff), held(0) { }
+
+  // button is down, debounced
+  uint8_t button_down() { return b==0x00; }
+
+  // button is up and debounced, and its press has been reported
+  uint8_t button_idle() { return b==0xff && !held; }
+
+  // button was used together with encoder, so its release
+  // does not count as a press
+  void cancel_press() { held=LONG_PRESS_TICKS; }
+
+  // debounce and read button presses. returns SHORT_PRESS when button
+  // is released before LONG_PRESS_TICKS, and LONG_PRESS once when
+  // button has been held down for that long
   int8_t read_button()
   {
-    static uint8_t b=0;
     b=(b<<1)|BUTTON_STATUS();
-    if (b==0xf8)
-      return 1;
-    return 0;
+    if (b==0x00) { // button down
+      if (held<LONG_PRESS_TICKS && ++held==LONG_PRESS_TICKS)
+        return LONG_PRESS;
+      return NO_PRESS;
+    }
+    if (b==0xff) { // button up
+      if (held && held<LONG_PRESS_TICKS) {
+        held=0;
+        return SHORT_PRESS;
+      }
+      held=0;
+    }
+    return NO_PRESS;
   }
 
   // The rotary encoder reading function is from
   // http://www.circuitsathome.com/mcu/reading-rotary-encoder-on-arduino
-  // returns change in encoder state (-1,0,1)
+  // returns change in encoder state (-1,0,1). called from pin change
+  // interrupt, so that no encoder state is missed
   // each encoder step may result in more in one increment/decrement, depending
   // on encoder, this one is for 2 steps per click
   int8_t read_encoder()
@@ -0,0 +1,49 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "events.hpp"
+
+Event Events::queue[EVENT_QUEUE_SIZE];
+volatile uint8_t Events::head;
+volatile uint8_t Events::tail;
+#ifdef TELEMETRY
+EventStats Events::stats;
+#endif
+
+uint8_t Events::get(Event *e,uint16_t now)
+{
+  uint8_t t=tail;
+  if (t==head)
+    return 0;
+  *e=queue[t];
+  tail=(t+1)&(EVENT_QUEUE_SIZE-1);
+#ifdef TELEMETRY
+  if (e->type<EV_COUNT) {
+    uint16_t latency=now-e->stamp;
+    stats.count[e->type]++;
+    if (latency>stats.latency[e->type])
+      stats.latency[e->type]=latency;
+  }
+#endif
+  return 1;
+}
@@ -0,0 +1,109 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __events_hpp__
+#define __events_hpp__
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "telemetry.hpp"
+
+#define EVENT_QUEUE_SIZE 8 // must be power of 2
+
+enum EVENT_TYPES {
+  EV_TICK,     // main loop tick
+  EV_ENCODER,  // arg is encoder detents turned, negative counterclockwise
+  EV_BUTTON,   // arg is button pin level, 0 is down
+  EV_POWER,    // arg is power switch pin level, 0 is on
+  EV_RDS,      // RDS group decoded
+  EV_TUNED,    // tune or seek completed
+  EV_COUNT
+};
+
+// stamp is time of posting in 32us Timer0 steps, low bits
+// are timer count and high bits are ticks
+struct Event
+{
+  uint8_t type;
+  int8_t arg;
+  uint16_t stamp;
+};
+
+// dispatch statistics, only kept in TELEMETRY builds
+struct EventStats
+{
+  uint16_t count[EV_COUNT];   // events dispatched by type
+  uint16_t latency[EV_COUNT]; // longest post to dispatch time, 32us steps
+  uint16_t dropped;           // events lost to full queue
+};
+
+// single producer single consumer event queue. interrupt handlers
+// do not nest, so together they are the single producer, and main
+// loop is the consumer. main loop posts its own events with
+// interrupts disabled
+//
+class Events
+{
+  static Event queue[EVENT_QUEUE_SIZE];
+  static volatile uint8_t head,tail;
+#ifdef TELEMETRY
+  static EventStats stats;
+#endif
+
+public:
+
+  // add event to queue, to be called with interrupts disabled
+  static void post(uint8_t type,int8_t arg,uint16_t stamp)
+  {
+    uint8_t h=head,n=(h+1)&(EVENT_QUEUE_SIZE-1);
+    if (n==tail) {
+#ifdef TELEMETRY
+      stats.dropped++;
+#endif
+      return;
+    }
+    queue[h].type=type;
+    queue[h].arg=arg;
+    queue[h].stamp=stamp;
+    head=n;
+  }
+
+  // add event from main loop
+  static void post_main(uint8_t type,int8_t arg,uint16_t stamp)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      post(type,arg,stamp);
+    }
+  }
+
+  static uint8_t pending() { return head!=tail; }
+
+  // take next event from queue, returns 0 if there is none.
+  // now is current time for latency statistics
+  static uint8_t get(Event *e,uint16_t now);
+
+#ifdef TELEMETRY
+  static const EventStats *get_stats() { return &stats; }
+#endif
+};
+
+#endif
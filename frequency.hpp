@@ -0,0 +1,104 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __frequency_hpp__
+#define __frequency_hpp__
+#include <avr/io.h>
+#include <string.h>
+
+// frequency in 10kHz units as 5 BCD digits, most significant first.
+// it is kept up to date by adding or subtracting channel spacing on
+// each tuning step, so that showing it needs no division
+//
+class FrequencyBCD
+{
+  int8_t d[5];
+
+  // add n to digit at pos, and propagate carry or borrow
+  void add(uint8_t pos,int8_t n)
+  {
+    d[pos]+=n;
+    while (pos>0) {
+      if (d[pos]>9) {
+        d[pos]-=10;
+        d[--pos]++;
+      }
+      else if (d[pos]<0) {
+        d[pos]+=10;
+        d[--pos]--;
+      }
+      else
+        break;
+    }
+  }
+
+public:
+
+  // convert from binary with shift and add 3 method
+  void set(uint16_t f)
+  {
+    uint8_t i,j;
+    memset(d,0,sizeof(d));
+    for (i=0;i<16;i++) {
+      for (j=0;j<5;j++)
+        if (d[j]>=5)
+          d[j]+=3;
+      for (j=0;j<4;j++)
+        d[j]=((d[j]<<1)&0x0f)|(d[j+1]>>3);
+      d[4]=((d[4]<<1)&0x0f)|(f>>15);
+      f<<=1;
+    }
+  }
+
+  // step by spacing (in 10kHz units) up if dir>0, down otherwise
+  void step(uint8_t spacing,int8_t dir)
+  {
+    int8_t tens=0;
+    while (spacing>=10) {
+      spacing-=10;
+      tens++;
+    }
+    if (dir<0) {
+      add(4,-spacing);
+      add(3,-tens);
+    }
+    else {
+      add(4,spacing);
+      add(3,tens);
+    }
+  }
+
+  // write "NNN.N" to s, 5 characters, not terminated
+  void format(char *s)
+  {
+    s[0]=d[0]?'0'+d[0]:' ';
+    s[1]='0'+d[1];
+    s[2]='0'+d[2];
+    s[3]='.';
+    s[4]='0'+d[3];
+  }
+
+  FrequencyBCD() { memset(d,0,sizeof(d)); }
+};
+
+#endif
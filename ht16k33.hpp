@@ -0,0 +1,153 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __ht16k33_hpp__
+#define __ht16k33_hpp__
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <string.h>
+#include "baseradio.hpp"
+
+#define HT16K33_ADDRESS 0x70     // A0..A2 open
+#define HT16K33_BRIGHTNESS 15    // 0..15
+#define HT16K33_RETRIES 3        // failed writes sent again in a row
+
+// HT16K33 commands
+#define HT_OSCILLATOR_ON 0x21
+#define HT_DISPLAY_ON 0x81       // blinking off
+#define HT_DIMMING 0xe0
+
+// 14 segment font for the 64 character display set 0x20..0x5f, same
+// as DL2416. bit 0..5 are segments A..F, then G1 G2 H J K L M N and DP
+static const uint16_t ht_font[64] PROGMEM =
+{
+  0x0000,0x0006,0x0220,0x12ce,0x12ed,0x0c24,0x235d,0x0400, // 20  !"#$%&'
+  0x2400,0x0900,0x3fc0,0x12c0,0x0800,0x00c0,0x4000,0x0c00, // 28 ()*+,-./
+  0x0c3f,0x0006,0x00db,0x008f,0x00e6,0x2069,0x00fd,0x0007, // 30 01234567
+  0x00ff,0x00ef,0x1200,0x0a00,0x2400,0x00c8,0x0900,0x1083, // 38 89:;<=>?
+  0x02bb,0x00f7,0x128f,0x0039,0x120f,0x00f9,0x0071,0x00bd, // 40 @ABCDEFG
+  0x00f6,0x1209,0x001e,0x2470,0x0038,0x0536,0x2136,0x003f, // 48 HIJKLMNO
+  0x00f3,0x203f,0x20f3,0x00ed,0x1201,0x003e,0x0c30,0x2836, // 50 PQRSTUVW
+  0x2d00,0x1500,0x0c09,0x0039,0x2100,0x000f,0x0c03,0x0008  // 58 XYZ[\]^_
+};
+
+// 8 digit 14 segment LED display on HT16K33, sharing the TWI bus with
+// the radio. digit n is display RAM row n, two bytes at address 2n,
+// low byte first. show() posts only the changed digits to the bus
+// arbiter of the radio, so a frame costs the radio at most one short
+// write in a tick when the radio does not need the bus
+//
+class HT16K33
+{
+  BaseRadio *bus;       // arbiter, NULL until attached
+  uint16_t ram[8];      // segments on display, or posted
+  uint8_t tx[17];       // RAM address and changed rows, posted transfer
+  uint8_t lo,hi;        // rows in posted transfer
+  uint8_t retries;      // failed writes in a row
+
+  static uint16_t glyph(char c)
+  {
+    if (c>='a' && c<='z')
+      c-='a'-'A';
+    c-=' ';
+    if ((uint8_t)c>=64)
+      return 0;
+    return pgm_read_word(&ht_font[(uint8_t)c]);
+  }
+
+  void command(uint8_t c)
+  {
+    bus->i2c_command(HT16K33_ADDRESS,&c,1);
+  }
+
+public:
+
+  HT16K33() : bus(NULL), retries(0) { invalidate(); }
+
+  // start the chip, called once after the bus is initialized
+  void attach(BaseRadio *b)
+  {
+    bus=b;
+    command(HT_OSCILLATOR_ON);
+    command(HT_DIMMING|HT16K33_BRIGHTNESS);
+    command(HT_DISPLAY_ON);
+    invalidate();
+  }
+
+  // force all digits out with next frame
+  void invalidate()
+  {
+    memset(ram,0xff,sizeof(ram)); // not a glyph
+  }
+
+  // to be called on every tick, after the bus arbiter has run. rows of
+  // a failed write are not known to be on display, so they are marked
+  // changed. returns 1 if they should be sent again with show(), up to
+  // HT16K33_RETRIES times in a row. after that they go with the next
+  // frame that changes
+  uint8_t check()
+  {
+    if (!bus)
+      return 0;
+    if (!bus->i2c_post_failed()) {
+      if (!bus->i2c_posted())
+        retries=0;
+      return 0;
+    }
+    memset(&ram[lo],0xff,(hi-lo+1)*2);
+    return ++retries<=HT16K33_RETRIES;
+  }
+
+  // update display to 8 characters of frame. if the previous frame is
+  // still waiting for the bus, its rows are sent along with new ones
+  void show(const char *frame)
+  {
+    uint8_t i,first=8,last=0;
+    uint16_t s;
+    for (i=0;i<8;i++) {
+      s=glyph(frame[i]);
+      if (s!=ram[i]) {
+        ram[i]=s;
+        if (first==8)
+          first=i;
+        last=i;
+      }
+    }
+    if (!bus || first==8)
+      return;
+    if (bus->i2c_posted()) {
+      if (lo<first)
+        first=lo;
+      if (hi>last)
+        last=hi;
+    }
+    lo=first;
+    hi=last;
+    tx[0]=first*2;
+    memcpy(tx+1,&ram[first],(last-first+1)*2);
+    bus->i2c_post(HT16K33_ADDRESS,tx,(last-first+1)*2+1);
+  }
+
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __i2ctrace_hpp__
+#define __i2ctrace_hpp__
+#include <avr/io.h>
+
+// I2C transaction tracer, build option, rename to I2CTRACE to enable.
+// every transfer on either bus is logged to a RAM ring. the ring is
+// the global i2c_trace, so it can also be read from simulator memory
+#define noI2CTRACE
+
+#define I2C_TRACE_SIZE 8     // ring entries, must be power of 2
+#define I2C_TRACE_READ 0x80  // in addr, transfer was a read
+#define I2C_TRACE_SOFT 0x80  // in len, transfer was on bit-banged bus
+
+struct I2CTraceEntry
+{
+  uint16_t stamp;  // start of transfer, 32us steps, see get_stamp()
+  uint8_t addr;    // 7 bit slave address and I2C_TRACE_READ
+  uint8_t len;     // bytes requested and I2C_TRACE_SOFT
+  uint8_t done;    // bytes transferred, less than requested on error
+};
+
+// running totals, these only ever increase except rate
+struct I2CTraceTotals
+{
+  uint16_t transfers;    // all logged transfers
+  uint16_t failed;       // transfers that did not complete
+  uint32_t bytes;        // bytes transferred
+  uint16_t rate;         // bytes in last full window of 32768 stamps, 1.05s
+};
+
+struct I2CTrace
+{
+  I2CTraceTotals totals;
+  uint16_t window;       // bytes in current window
+  uint16_t window_stamp; // start of current window
+  uint8_t head;          // next entry to write, also the oldest entry
+  I2CTraceEntry ring[I2C_TRACE_SIZE];
+};
+
+#ifdef I2CTRACE
+
+extern I2CTrace i2c_trace;   // in baseradio.cpp
+uint16_t get_stamp();        // in silicon_radio.cpp
+
+// log a transfer that started at stamp. done is logged after the
+// transfer, so the entry has the start time and the outcome
+static inline void i2c_trace_log(uint16_t stamp,uint8_t addr,uint8_t len,uint8_t done)
+{
+  I2CTraceEntry *e=&i2c_trace.ring[i2c_trace.head];
+  e->stamp=stamp;
+  e->addr=addr;
+  e->len=len;
+  e->done=done;
+  i2c_trace.head=(i2c_trace.head+1)&(I2C_TRACE_SIZE-1);
+  i2c_trace.totals.transfers++;
+  if (done!=(len&~I2C_TRACE_SOFT))
+    i2c_trace.totals.failed++;
+  i2c_trace.totals.bytes+=done;
+  if ((uint16_t)(stamp-i2c_trace.window_stamp)>=0x8000) {
+    i2c_trace.totals.rate=i2c_trace.window;
+    i2c_trace.window=0;
+    i2c_trace.window_stamp=stamp;
+  }
+  i2c_trace.window+=done;
+}
+
+#define I2C_TRACE_START() uint16_t trace_stamp=get_stamp()
+#define I2C_TRACE(addr,len,done) i2c_trace_log(trace_stamp,addr,len,done)
+#else
+#define I2C_TRACE_START()
+#define I2C_TRACE(addr,len,done)
+#endif
+
+#endif
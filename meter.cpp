@@ -23,11 +23,11 @@ SOFTWARE.
 */
 #include "meter.hpp"
 
-uint8_t logtable[] =
+#define C4(i) meter_curve(i),meter_curve(i+1),meter_curve(i+2),meter_curve(i+3)
+
+const uint16_t metertable[METER_STEPS+1] PROGMEM =
 {
-0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,3,
-3,3,4,4,5,6,6,7,8,8,9,10,11,12,13,14,
-15,16,17,18,19,20,21,22,23,25,26,27,28,29,30,32,
-33,34,35,37,38,39,40,42,43,44,46,47,49,50,52,54,
-55,57,59,61,63,64,67,68,70,72,74,75
+C4(0),C4(4),C4(8),C4(12),C4(16),C4(20),C4(24),C4(28),
+C4(32),C4(36),C4(40),C4(44),C4(48),C4(52),C4(56),C4(60),
+C4(64),C4(68),C4(72)
 };
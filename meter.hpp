@@ -24,44 +24,102 @@ SOFTWARE.
 #ifndef __meter_hpp__
 #define __meter_hpp__
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <string.h>
+#include <util/atomic.h>
 
-extern uint8_t logtable[]; // in meter.cpp
+#define METER_STEPS 75         // highest value accepted by set()
+#define METER_TOP 1023         // 10 bit PWM, about 1kHz at clk/8
+#define METER_FULL_SCALE 300   // PWM value for full needle deflection
+#define METER_DIVIDER 3        // ballistics run on every 4th PWM cycle
+#define METER_ATTACK 3         // attack, 8 updates or about 33ms
+#define METER_DECAY 6          // decay, 64 updates or about 260ms
 
-// VU meter driver, uses OC1A output for PWM signal
-// that reflect the currently set value
-// the set value can be 0..75, and is converted to internal
-// by lookup from logtable. the conversion is done to make
+// PWM value for meter input value i. the square law curve makes
 // logarithmic VU more responsive to radio signal level changes
+constexpr uint16_t meter_curve(uint8_t i)
+{
+  return ((uint32_t)i*i*METER_FULL_SCALE+(METER_STEPS*METER_STEPS)/2)/
+    (METER_STEPS*METER_STEPS);
+}
+
+// TCNT1 for meter_cycles(). the 16 bit read goes through the TEMP
+// register that TIMER1_OVF also uses when it writes OCR1A, so the
+// read must not be interrupted
+static inline uint16_t meter_count()
+{
+  uint16_t t;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t=TCNT1;
+  }
+  return t;
+}
+
+// cpu cycles since meter_count() returned start, for timing short
+// pieces of code while the meter PWM runs at clk/8. 0 if the timer
+// is stopped
+static inline uint16_t meter_cycles(uint16_t start)
+{
+  uint16_t end=meter_count();
+  if (!(TCCR1B&7))
+    return 0;
+  return ((end>=start)?end-start:end+METER_TOP+1-start)*8;
+}
+
+extern const uint16_t metertable[METER_STEPS+1] PROGMEM; // in meter.cpp
+
+// VU meter driver, uses OC1A output for PWM signal that reflects
+// the currently set value. set() only posts the new value, the needle
+// is moved towards it from timer overflow interrupt, with fast attack
+// and slow decay, so that the movement is smooth
 //
 class VU_Meter
 {
-uint16_t value;
+volatile uint8_t level;  // posted value, 0..METER_STEPS
+uint16_t position;       // current PWM value, 10.6 fixed point
+uint8_t divider;
 public:
-  VU_Meter() {}
+  VU_Meter() : level(0), position(0), divider(0) {}
 
+  // fast PWM mode 14 with ICR1 as TOP, output on OC1A, clk/8
   void start()
   {
-    TCCR1A=0x81; // fast PWM mode 5, output on OC1A, clear at OCR1A
-    TCCR1B=0x0a; // clk/8
-    OCR1AH=value>>8;
-    OCR1AL=value&0xff;
+    ICR1=METER_TOP;
+    TCCR1A=(1<<COM1A1)|(1<<WGM11);
+    TCCR1B=(1<<WGM13)|(1<<WGM12)|(1<<CS11);
+    TIMSK1|=(1<<TOIE1);
   }
-  
-  void stop()
+
+  // stop timer, and drop needle to zero
+  void off()
   {
-    TCCR1A=0x00;
+    TIMSK1&=~(1<<TOIE1);
+    TCCR1A=0;
+    TCCR1B=0;
+    position=0;
   }
-  
+
   void set(uint8_t val)
   {
-    if (val>75)
-      val=75;
-    value=logtable[val];
-    OCR1AH=value>>8;
-    OCR1AL=value&0xff;
+    if (val>METER_STEPS)
+      val=METER_STEPS;
+    level=val;
   }
-  
+
+  // move needle towards set value, called from timer 1 overflow interrupt
+  void isr()
+  {
+    uint16_t t;
+    if ((++divider)&METER_DIVIDER)
+      return;
+    t=pgm_read_word(&metertable[level])<<6;
+    if (t>position)
+      position+=((t-position)>>METER_ATTACK)|1;
+    else
+      position-=(position-t)>>METER_DECAY;
+    OCR1A=position>>6;
+  }
+
 };
 
 #endif
@@ -0,0 +1,51 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "presets.hpp"
+
+#define EMPTY { PRESET_EMPTY,0,{ 0,0,0,0,0,0,0,0 } }
+
+Preset EEMEM ee_presets[PRESETS] = {
+  EMPTY,EMPTY,EMPTY,EMPTY,EMPTY,EMPTY,EMPTY,EMPTY
+};
+
+// a preset still being written is taken from the write buffer, EEPROM
+// has only part of it yet
+uint8_t Presets::load(uint8_t n,Preset *p)
+{
+  n&=PRESETS-1;
+  if (settings->block_busy() && n==buf_n)
+    memcpy(p,&buf,sizeof(Preset));
+  else
+    settings->read_block(p,&ee_presets[n],sizeof(Preset));
+  return p->channel!=PRESET_EMPTY;
+}
+
+// waits only if previous preset is still being written
+void Presets::store(uint8_t n,const Preset *p)
+{
+  while (settings->block_busy());
+  buf_n=n&(PRESETS-1);
+  memcpy(&buf,p,sizeof(Preset));
+  settings->write_block(&buf,&ee_presets[buf_n],sizeof(Preset));
+}
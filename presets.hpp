@@ -0,0 +1,68 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __presets_hpp__
+#define __presets_hpp__
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "settings.hpp"
+
+#define PRESETS 8             // must be power of 2
+#define PRESET_EMPTY 0xffff   // channel value of unused preset
+
+// station memory. in addition to channel, the station PI code and name
+// are kept, so that recalled station can be shown immediately, without
+// waiting for RDS
+struct Preset
+{
+  uint16_t channel;
+  uint16_t pi;
+  char ps[8];
+};
+
+class Presets
+{
+  Settings *settings; // EEPROM is shared with settings store
+  uint8_t current;
+  Preset buf;         // preset being written by settings store ISR
+  uint8_t buf_n;
+public:
+
+  uint8_t get_current() { return current; }
+
+  // advance to next preset number, wraps around
+  uint8_t next()
+  {
+    current=(current+1)&(PRESETS-1);
+    return current;
+  }
+
+  // read preset n, returns 0 if the preset is not set
+  uint8_t load(uint8_t n,Preset *p);
+  // preset is written in background, the main loop does not wait
+  void store(uint8_t n,const Preset *p);
+
+  Presets(Settings *s) : settings(s), current(PRESETS-1) { }
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "ptyseek.hpp"
+
+uint8_t PTYSeek::start(int8_t pty,uint8_t direction)
+{
+  if (pty<=0 || pty>31)
+    return 0;
+  if (pty!=cache_pty) {
+    memset(skip,0,sizeof(skip));
+    cache_pty=pty;
+  }
+  target=pty;
+  up=direction;
+  start_channel=radio->get_channel();
+  seek();
+  return 1;
+}
+
+uint8_t PTYSeek::run(uint16_t now)
+{
+  uint16_t channel;
+  int8_t pty;
+  switch (state) {
+    case PTY_SEEKING:
+      if (radio->is_tuning())
+        break;
+      channel=radio->get_channel();
+      if (channel==start_channel) { // wrapped around, or nothing found
+        state=PTY_IDLE;
+        return 1;
+      }
+      stats.candidates++;
+      if (skipped(channel)) {
+        stats.cached++;
+        seek();
+        break;
+      }
+      // dwell time from signal strength, weak stations take longer
+      // to get a clean group through
+      dwell=PTY_DWELL_MAX;
+      if (radio->get_rssi()>PTY_RSSI_WEAK)
+        dwell-=(uint16_t)(radio->get_rssi()-PTY_RSSI_WEAK)*PTY_DWELL_SLOPE;
+      if ((int16_t)dwell<PTY_DWELL_MIN)
+        dwell=PTY_DWELL_MIN;
+      dwell_start=now;
+      state=PTY_DWELL;
+      break;
+    case PTY_DWELL:
+      pty=decoder->get_pty();
+      if (pty==target) {
+        state=PTY_IDLE;
+        return 1;
+      }
+      if (pty>=0)
+        stats.rejected++;
+      else if ((uint16_t)(now-dwell_start)>=dwell)
+        stats.no_rds++;
+      else
+        break;
+      stats.reject_ticks+=(uint16_t)(now-dwell_start);
+      mark(radio->get_channel());
+      seek();
+      break;
+  }
+  return 0;
+}
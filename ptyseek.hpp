@@ -0,0 +1,109 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __ptyseek_hpp__
+#define __ptyseek_hpp__
+#include <avr/io.h>
+#include <string.h>
+#include "baseradio.hpp"
+
+#define PTY_CACHE_CHANNELS 256 // channels above this are not cached
+#define PTY_DWELL_MIN 128      // ticks to wait for RDS on strong station, 3 groups
+#define PTY_DWELL_MAX 512      // and on a station at seek threshold, 12 groups
+#define PTY_RSSI_WEAK 20       // seek threshold, dwell is longest here
+#define PTY_DWELL_SLOPE 16     // dwell ticks less for each dBuV above that
+
+struct PTYStats
+{
+  uint16_t candidates;   // stations found by hardware seek
+  uint16_t cached;       // skipped without dwell, known not to match
+  uint16_t rejected;     // dwelled on, but PTY did not match
+  uint16_t no_rds;       // dwell timed out without RDS
+  uint32_t reject_ticks; // total dwell time of rejected and no_rds stations
+};
+
+// program type seek. hardware seek finds the next station, and the
+// first RDS group received tells its program type. the wait for RDS
+// is cut short on strong stations, where RDS is there at once if at
+// all. stations that did not match are remembered, and skipped
+// without waiting on later seeks for the same program type
+//
+class PTYSeek
+{
+  BaseRadio *radio;
+  RDSDecoder *decoder;
+  uint8_t state;
+  uint8_t target;           // program type looked for
+  uint8_t up;               // seek direction
+  uint16_t start_channel;   // seek stops if it comes back here
+  uint16_t dwell_start;
+  uint16_t dwell;           // ticks to wait for RDS on current station
+  uint8_t cache_pty;        // program type the skip bitmap is for
+  uint8_t skip[PTY_CACHE_CHANNELS/8]; // channels known not to match
+  PTYStats stats;
+
+  enum { PTY_IDLE, PTY_SEEKING, PTY_DWELL } PTYSTATES;
+
+  void mark(uint16_t channel)
+  {
+    if (channel<PTY_CACHE_CHANNELS)
+      skip[channel>>3]|=1<<(channel&7);
+  }
+
+  uint8_t skipped(uint16_t channel)
+  {
+    return (channel<PTY_CACHE_CHANNELS)?(skip[channel>>3]>>(channel&7))&1:0;
+  }
+
+  void seek()
+  {
+    if (up)
+      radio->seek_up();
+    else
+      radio->seek_down();
+    state=PTY_SEEKING;
+  }
+
+public:
+
+  // start seeking for next station with program type pty,
+  // returns 0 if pty is not a program type
+  uint8_t start(int8_t pty,uint8_t direction);
+
+  // advance seek, to be called on every tick. returns 1 once
+  // when seek has ended on a matching station, or back on the
+  // station where it started
+  uint8_t run(uint16_t now);
+
+  void cancel() { state=PTY_IDLE; }
+  uint8_t active() { return state!=PTY_IDLE; }
+  const PTYStats *get_stats() { return &stats; }
+
+  PTYSeek(BaseRadio *r,RDSDecoder *d) : radio(r), decoder(d), state(PTY_IDLE),
+    cache_pty(0)
+  {
+    memset(&stats,0,sizeof(stats));
+  }
+};
+
+#endif
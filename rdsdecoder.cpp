@@ -21,97 +21,403 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
+#include <avr/pgmspace.h>
 #include "baseradio.hpp"
+#include "meter.hpp"
+
+// EBU Latin (IEC 62106 annex E) to the 64 character set of DL2416.
+// lower case is folded to upper, accented letters lose the accent and
+// other symbols are replaced with something close or placeholder.
+// characters are translated once, when they are received, so display
+// only copies them
+#define PH RDS_PLACEHOLDER
+static const char charmap[256] PROGMEM =
+{
+  ' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ', // 00 control codes
+  ' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ', // 10 control codes
+  ' ','!','"','#','$','%','&','\'','(',')','*','+',',','-','.','/', // 20
+  '0','1','2','3','4','5','6','7','8','9',':',';','<','=','>','?', // 30
+  '@','A','B','C','D','E','F','G','H','I','J','K','L','M','N','O', // 40
+  'P','Q','R','S','T','U','V','W','X','Y','Z','[','\\',']','-','_', // 50
+  '\'','A','B','C','D','E','F','G','H','I','J','K','L','M','N','O', // 60 lower case to upper
+  'P','Q','R','S','T','U','V','W','X','Y','Z','[','I',']','-',PH, // 70
+  'A','A','E','E','I','I','O','O','U','U','N','C','S','B','!','Y', // 80 a' a` e' e` i' i` o' o` u' u` N~ C, S, beta ! IJ
+  'A','A','E','E','I','I','O','O','U','U','N','C','S','G','I','Y', // 90 a^ a: e^ e: i^ i: o^ o: u^ u: n~ c, s, g~ i ij
+  'A','A','C','%','G','E','N','O','P','E','L','$','<','^','>','V', // a0 a_ alpha (c) %o G~ e< n< o" pi euro pound $ arrows
+  'O','1','2','3','+','I','N','U','U','?','/','*',PH,PH,PH,'S', // b0 o_ 1 2 3 +- I. n' u" mu ? div deg 1/4 1/2 3/4 section
+  'A','A','E','E','I','I','O','O','U','U','R','C','S','Z','D','L', // c0 A' A` E' E` I' I` O' O` U' U` R< C< S< Z< D- L.
+  'A','A','E','E','I','I','O','O','U','U','R','C','S','Z','D','L', // d0 A^ A: E^ E: I^ I: O^ O: U^ U: r< c< s< z< d- l.
+  'A','A','A','O','Y','Y','O','O','P','N','R','C','S','Z','T','D', // e0 A~ A* AE OE y^ Y' O~ O/ Thorn Eng R' C' S' Z' T- eth
+  'A','A','A','O','W','Y','O','O','P','N','R','C','S','Z','T',PH // f0 a~ a* ae oe w^ y' o~ o/ thorn eng r' c' s' z' t-
+};
+#undef PH
+
+char rds_char(uint8_t c)
+{
+  return pgm_read_byte(&charmap[c]);
+}
+
+// known open data applications, index is the handler number
+// kept in oda[]
+const ODAApp RDSDecoder::apps[] PROGMEM =
+{
+  { 0, NULL },
+#ifdef RTPLUS
+  { ODA_AID_RTPLUS, RDSDecoder::rtplus },
+#endif
+};
+
+#define ODA_APPS (sizeof(apps)/sizeof(apps[0]))
+
+// 3A announced that application aid is carried in group type, given
+// as type and version like in block b. unknown application frees the
+// group type
+void RDSDecoder::oda_register(uint8_t group,uint16_t aid)
+{
+  uint8_t h,shift=(group&1)<<2;
+  for (h=ODA_APPS-1;h;h--)
+    if (pgm_read_word(&apps[h].aid)==aid)
+      break;
+  oda[group>>1]=(oda[group>>1]&~(15<<shift))|(h<<shift);
+}
+
+#ifdef RTPLUS
+void RDSDecoder::rtplus_tag(uint8_t type,uint8_t start,uint8_t len)
+{
+  uint8_t i;
+  if (type==RTP_TITLE)
+    i=0;
+  else if (type==RTP_ARTIST)
+    i=1;
+  else
+    return;
+  if (start+len>=64)
+    return;
+  rtp_start[i]=start;
+  rtp_len[i]=len+1;
+}
+
+// RT+ group has item toggle and running bits, and two tags of content
+// type, start and length marker. first tag starts from bit 2 of block b
+// and second one ends at block d bit 0
+void RDSDecoder::rtplus(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  if (((b>>4)&1)!=d->rtp_toggle) { // new item, tags of old one are gone
+    d->rtp_toggle=(b>>4)&1;
+    memset(d->rtp_len,0,sizeof(d->rtp_len));
+  }
+  if (!(b&0x08)) {                 // no item running
+    memset(d->rtp_len,0,sizeof(d->rtp_len));
+    return;
+  }
+  d->rtplus_tag(((b&7)<<3)|(c>>13),(c>>7)&0x3f,(c>>1)&0x3f);
+  d->rtplus_tag(((c&1)<<5)|(e>>11),(e>>5)&0x3f,e&0x1f);
+}
+#endif
+
+#ifdef RDSSTATS
+// time stamp for statistics, 0 is reserved for 'not yet'
+#define STAMP(d) ((d)->clock?(d)->clock:1)
+#endif
+
+// start collecting new radio text, on A/B flag or group version change.
+// the text shown stays until the new one is complete
+void RDSDecoder::new_rt(uint8_t channel)
+{
+#ifdef RDSSTATS
+  if ((channel^tchannel)&0x10)
+    stats.toggles++;
+#endif
+  tchannel=channel;
+  memset(rtbuf,0,sizeof(rtbuf));
+  rt_seen=0;
+  rt_last=15;
+}
+
+// store two radio text characters from block at pos. carriage
+// return ends the text, and makes this the last segment needed
+void RDSDecoder::rt_chars(uint8_t pos,uint16_t block,uint8_t segment)
+{
+  uint8_t c;
+  c=block>>8;
+  if (c=='\r') {
+    rt_last=segment;
+    rtbuf[pos]=0;
+  }
+  else
+    rtbuf[pos]=rds_char(c);
+  c=block&0xff;
+  if (c=='\r') {
+    rt_last=segment;
+    rtbuf[pos+1]=0;
+  }
+  else
+    rtbuf[pos+1]=rds_char(c);
+}
+
+// mark segment received, and publish the text when all segments
+// up to the last one are in. the station may send a longer text
+// without toggling A/B, so the end is looked for again after that
+void RDSDecoder::rt_segment(uint8_t segment)
+{
+  uint16_t need;
+  rt_seen|=1<<segment;
+  need=(uint16_t)((2UL<<rt_last)-1);
+  if ((rt_seen&need)==need) {
+#ifdef RTPLUS
+    if (memcmp(rt,rtbuf,sizeof(rt))) // tags received so far may be
+      memset(rtp_len,0,sizeof(rtp_len)); // for the old text
+#endif
+    memcpy(rt,rtbuf,sizeof(rt));
+    rt_seen=0;
+    rt_last=15;
+#ifdef RDSSTATS
+    if (!stats.rt_ticks)
+      stats.rt_ticks=STAMP(this);
+#endif
+  }
+}
+
+// 0A and 0B, station name
+void RDSDecoder::group_ps(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  uint8_t segment=b&3;
+  d->psbuf[segment<<1]=rds_char(e>>8);
+  d->psbuf[(segment<<1)+1]=rds_char(e&0xff);
+  d->ps_seen|=1<<segment;
+  if (d->ps_seen==0x0f) {  // publish only complete name
+    memcpy(d->ps,d->psbuf,sizeof(d->psbuf));
+    d->ps_seen=0;
+#ifdef RDSSTATS
+    if (!d->stats.ps_ticks)
+      d->stats.ps_ticks=STAMP(d);
+#endif
+  }
+}
+
+// 2A 64 character and 2B 32 character radio text
+void RDSDecoder::group_rt(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  uint8_t segment=b&0xf;
+  if (((b&0x10)|((b>>11)&1))!=d->tchannel)
+    d->new_rt((b&0x10)|((b>>11)&1));
+  if (b&0x0800)            // 2B
+    d->rt_chars(segment<<1,e,segment);
+  else {                   // 2A
+    d->rt_chars(segment<<2,c,segment);
+    d->rt_chars((segment<<2)+2,e,segment);
+  }
+  d->rt_segment(segment);
+}
+
+#if RDS_ENABLED(1,0)
+// 1A slow labelling codes, variant 0 has extended country code
+void RDSDecoder::group_ecc(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  if (!(c&0x7000))
+    d->ecc=c&0xff;
+}
+#endif
+
+#if RDS_ENABLED(3,0)
+// 3A open data application announcement
+void RDSDecoder::group_oda(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  if ((b&0x1f) && (b&0x1f)!=0x1f)
+    d->oda_register(b&0x1f,e);
+}
+#endif
+
+#if RDS_ENABLED(4,0)
+// 4A clock time, modified julian day and UTC with local offset in
+// half hours. date conversion is from IEC 62106 annex G, in integers
+void RDSDecoder::group_ct(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  uint32_t mjd=((uint32_t)(b&3)<<15)|(c>>1);
+  int16_t minutes=(((c&1)<<4)|(e>>12))*60+((e>>6)&0x3f);
+  uint32_t y,m,k,day,y365;
+  if (e&0x20)
+    minutes-=(e&0x1f)*30;
+  else
+    minutes+=(e&0x1f)*30;
+  if (minutes<0) {
+    minutes+=1440;
+    mjd--;
+  }
+  else if (minutes>=1440) {
+    minutes-=1440;
+    mjd++;
+  }
+  if (mjd<15079)           // before 1900, not a valid time
+    return;
+  y=(mjd*100-1507820)/36525;
+  y365=y*36525/100;
+  m=((mjd-14956-y365)*10000-1000)/306001;
+  day=mjd-14956-y365-m*306001/10000;
+  k=(m==14 || m==15)?1:0;
+  y+=k+1900;
+  m-=1+k*12;
+  d->time[0]='0'+minutes/600;
+  d->time[1]='0'+(minutes/60)%10;
+  d->time[2]=':';
+  d->time[3]='0'+(minutes%60)/10;
+  d->time[4]='0'+minutes%10;
+  d->date[0]='0'+day/10;
+  d->date[1]='0'+day%10;
+  d->date[2]='.';
+  d->date[3]='0'+m/10;
+  d->date[4]='0'+m%10;
+  d->date[5]='.';
+  d->date[6]='0'+y/1000;
+  d->date[7]='0'+(y/100)%10;
+  d->date[8]='0'+(y/10)%10;
+  d->date[9]='0'+y%10;
+}
+#endif
+
+#if RDS_ENABLED(8,0) && defined(TMC)
+// 8A traffic message channel
+void RDSDecoder::group_tmc(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  if (d->tmc)
+    d->tmc->decode(b,c,e);
+}
+#endif
+
+#if RDS_ENABLED(10,0)
+// 10A program type name, two segments of four characters
+void RDSDecoder::group_ptyn(RDSDecoder *d,uint16_t b,uint16_t c,uint16_t e)
+{
+  char *p=d->ptyn+((b&1)<<2);
+  if (((b>>4)&1)!=d->ptyn_ab) {
+    d->ptyn_ab=(b>>4)&1;
+    memset(d->ptyn,0,sizeof(d->ptyn));
+  }
+  p[0]=rds_char(c>>8);
+  p[1]=rds_char(c&0xff);
+  p[2]=rds_char(e>>8);
+  p[3]=rds_char(e&0xff);
+}
+#endif
+
+// handlers by group type and version, as in block b bits 15..11.
+// groups without handler here may be assigned to open data
+// applications
+#define H(t,v,h) (RDS_ENABLED(t,v)?RDSDecoder::h:NULL)
+#if RDS_ENABLED(1,0)
+#define G_1A H(1,0,group_ecc)
+#else
+#define G_1A NULL
+#endif
+#if RDS_ENABLED(3,0)
+#define G_3A H(3,0,group_oda)
+#else
+#define G_3A NULL
+#endif
+#if RDS_ENABLED(4,0)
+#define G_4A H(4,0,group_ct)
+#else
+#define G_4A NULL
+#endif
+#if RDS_ENABLED(8,0) && defined(TMC)
+#define G_8A H(8,0,group_tmc)
+#else
+#define G_8A NULL
+#endif
+#if RDS_ENABLED(10,0)
+#define G_10A H(10,0,group_ptyn)
+#else
+#define G_10A NULL
+#endif
+
+const GroupHandler RDSDecoder::groups[32] PROGMEM =
+{
+  H(0,0,group_ps), H(0,1,group_ps), G_1A,  NULL,  // 0A 0B 1A 1B
+  H(2,0,group_rt), H(2,1,group_rt), G_3A,  NULL,  // 2A 2B 3A 3B
+  G_4A,            NULL,            NULL,  NULL,  // 4A 4B 5A 5B
+  NULL,            NULL,            NULL,  NULL,  // 6A 6B 7A 7B
+  G_8A,            NULL,            NULL,  NULL,  // 8A 8B 9A 9B
+  G_10A,           NULL,            NULL,  NULL,  // 10A 10B 11A 11B
+  NULL,            NULL,            NULL,  NULL,  // 12A 12B 13A 13B
+  NULL,            NULL,            NULL,  NULL   // 14A 14B 15A 15B
+};
 
 void RDSDecoder::decode_group(uint16_t rdsa,uint16_t rdsb,uint16_t rdsc,uint16_t rdsd)
 {
-char c;
-  switch (rdsb>>11) {
-    case 0: // 0A
-    case 1: // 0B
-      pty=(rdsb&0x03e0)>>5;  // get program type and station name from
-      rdsb=(rdsb&3)<<1;      // basic info block
-      ps[rdsb]=rdsd>>8;
-      ps[rdsb+1]=rdsd&0xff;
-      return;
-    case 4: // 2A 64 character radio text 
-      if ((rdsb&0x10)!=tchannel) {
-        tchannel=rdsb&0x10;
-        memcpy(rt,rtbuf,sizeof(rt));
-        memset(rtbuf,0,sizeof(rtbuf));
-      }
-      rdsb=(rdsb&0xf)<<2;
-      c=rdsc>>8;
-      if (c=='\r')
-        c=0;
-      rtbuf[rdsb]=c;
-      c=rdsc&0xff;
-      if (c=='\r')
-        c=0;
-      rtbuf[rdsb+1]=c;
-      c=rdsd>>8;
-      if (c=='\r')
-        c=0;
-      rtbuf[rdsb+2]=c;
-      c=rdsd&0xff;
-      if (c=='\r')
-        c=0;
-      rtbuf[rdsb+3]=c;
-      rtbuf[64]='\0';
+  GroupHandler h;
+  uint8_t app;
+#ifdef RDSSTATS
+  uint16_t start=meter_count(),cycles;
+#endif
+  // a single group with different PI is most likely a reception error,
+  // station is changed only if next group has the same new PI. primed
+  // PI is replaced by first received one
+  if (rdsa!=pi) {
+    if (pi && !primed && rdsa!=candidate_pi) {
+      candidate_pi=rdsa;
+      RDSSTAT(stats.rejected++);
       return;
-    case 5: // 2B 32 character radio text
-      if ((rdsb&0x10)!=tchannel) {
-        tchannel=rdsb&0x10;
-        memcpy(rt,rtbuf,sizeof(rt));
-        memset(rtbuf,0,sizeof(rtbuf));
-      }
-      rdsb=(rdsb&0xf)<<1;
-      c=rdsd>>8;
-      if (c=='\r')
-        c=0;
-      rtbuf[rdsb]=c;
-      c=rdsd&0xff;
-      if (c=='\r')
-        c=0;
-      rtbuf[rdsb+1]=c;
-      rtbuf[32]='\0';
+    }
+    if (pi)
+      reset();
+    pi=rdsa;
+  }
+  primed=0;
+  candidate_pi=0;
+  pty=(rdsb>>5)&0x1f;  // program type is in block b of every group
+  RDSSTAT(stats.groups[rdsb>>11]++);
+  h=(GroupHandler)pgm_read_ptr(&groups[rdsb>>11]);
+  if (!h) {
+    app=oda_handler(rdsb>>11);
+    if (!app)
       return;
+    h=(GroupHandler)pgm_read_ptr(&apps[app].handler);
   }
+  h(this,rdsb,rdsc,rdsd);
+#ifdef RDSSTATS
+  cycles=meter_cycles(start);
+  if (cycles) {
+    if (cycles>stats.cycles_max)
+      stats.cycles_max=cycles;
+    stats.cycles+=cycles;
+    stats.timed++;
+  }
+#endif
 }
 
 #ifdef PROGRAMTYPENAMES
 const char * const _program_types[] = {
 "", // 0
-"News", // 1
-"Current", // 2
-"Information", // 3
-"Sport", // 4
-"Education", // 5
-"Drama", // 6
-"Culture", // 7
-"Science", // 8
-"Varied", // 9
-"Pop", // 10
-"Rock", // 11
-"Easy listening", // 12
-"Light classical", // 13
-"Serious classical", // 14
-"Music", // 15
-"Weather", // 16
-"Finance", // 17
-"Children", // 18
-"Social", // 19
-"Religion", // 20
-"Phone-in", // 21
-"Travel", // 22
-"Leisure", // 23
-"Jazz", // 24
-"Country", // 25
-"National", // 26
-"Oldies", // 27
-"Folk", // 28
-"Documentary", // 29
-"Alarm test", // 30
-"Alarm" // 31
+"NEWS", // 1
+"CURRENT", // 2
+"INFORMATION", // 3
+"SPORT", // 4
+"EDUCATION", // 5
+"DRAMA", // 6
+"CULTURE", // 7
+"SCIENCE", // 8
+"VARIED", // 9
+"POP", // 10
+"ROCK", // 11
+"EASY LISTENING", // 12
+"LIGHT CLASSICAL", // 13
+"SERIOUS CLASSICAL", // 14
+"MUSIC", // 15
+"WEATHER", // 16
+"FINANCE", // 17
+"CHILDREN", // 18
+"SOCIAL", // 19
+"RELIGION", // 20
+"PHONE-IN", // 21
+"TRAVEL", // 22
+"LEISURE", // 23
+"JAZZ", // 24
+"COUNTRY", // 25
+"NATIONAL", // 26
+"OLDIES", // 27
+"FOLK", // 28
+"DOCUMENTARY", // 29
+"ALARM TEST", // 30
+"ALARM" // 31
 };
 #endif
@@ -0,0 +1,53 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __region_hpp__
+#define __region_hpp__
+#include <avr/io.h>
+
+// broadcast band of the market the firmware is built for. select with
+// REGION=EU|US|JP_WIDE|JP in Makefile, EU is the default. frequencies
+// are in 10kHz units
+struct RegionProfile
+{
+  uint16_t min_frequency;
+  uint16_t max_frequency;
+  uint8_t spacing;      // channel spacing
+  uint8_t deemphasis;   // de-emphasis time constant, us
+};
+
+#if defined(REGION_US)
+constexpr RegionProfile region={ 8750,10790,20,75 }; // 87.5-107.9, odd tenths
+#elif defined(REGION_JP_WIDE)
+constexpr RegionProfile region={ 7600,10800,10,50 }; // 76-108
+#elif defined(REGION_JP)
+constexpr RegionProfile region={ 7600,9000,10,50 };  // 76-90
+#else
+constexpr RegionProfile region={ 8750,10800,10,50 }; // 87.5-108
+#endif
+
+// highest channel number in band
+constexpr uint16_t region_max_channel=
+  (region.max_frequency-region.min_frequency)/region.spacing;
+
+#endif
@@ -0,0 +1,176 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "scanner.hpp"
+
+#ifdef SCANNER
+
+// PI is checked the same way as in RDSDecoder, a single group with
+// other PI is taken for reception error
+void ScanDecoder::decode_group(uint16_t rdsa,uint16_t rdsb,uint16_t rdsc,uint16_t rdsd)
+{
+  uint8_t segment;
+  if (rdsa!=pi) {
+    if (pi && rdsa!=candidate_pi) {
+      candidate_pi=rdsa;
+      return;
+    }
+    if (pi)
+      reset();
+    pi=rdsa;
+  }
+  candidate_pi=0;
+  pty=(rdsb>>5)&0x1f;     // in block b of every group
+  if (rdsb>>12)           // not group type 0
+    return;
+  segment=rdsb&3;
+  psbuf[segment<<1]=rds_char(rdsd>>8);
+  psbuf[(segment<<1)+1]=rds_char(rdsd&0xff);
+  ps_seen|=1<<segment;
+  if (ps_seen==0x0f) {
+    memcpy(ps,psbuf,sizeof(ps));
+    ps_seen=0;
+  }
+}
+
+void Scanner::init()
+{
+  SoftSI4703::release();
+  if (!radio.is_connected())
+    return;
+  radio.init();
+  radio.set_decoder(&decoder);
+  state=SCAN_BOOT;
+}
+
+// put current station to table. same channel is updated, otherwise
+// the station takes a free entry or the weakest one, if it is stronger
+void Scanner::store()
+{
+  uint8_t i,slot=0,rssi=radio.get_rssi();
+  uint16_t channel=radio.get_channel();
+  for (i=0;i<SCAN_STATIONS;i++)
+    if (stations[i].channel==channel)
+      break;
+  if (i<SCAN_STATIONS)
+    slot=i;
+  else {
+    for (i=0;i<SCAN_STATIONS;i++) {
+      if (stations[i].channel==SCAN_FREE) {
+        slot=i;
+        break;
+      }
+      if (stations[i].rssi<stations[slot].rssi)
+        slot=i;
+    }
+    if (stations[slot].channel!=SCAN_FREE) {
+      if (stations[slot].rssi>=rssi)
+        return;
+      stats.replaced++;
+    }
+  }
+  stations[slot].channel=channel;
+  stations[slot].pi=decoder.get_pi();
+  stations[slot].rssi=rssi;
+  stations[slot].pty=decoder.get_pty();
+  memcpy(stations[slot].ps,decoder.get_ps(),sizeof(stations[slot].ps));
+  stations[slot].seen=1;
+}
+
+// seek wrapped to band start, drop stations that were not found
+void Scanner::end_pass()
+{
+  uint8_t i;
+  for (i=0;i<SCAN_STATIONS;i++) {
+    if (stations[i].channel==SCAN_FREE)
+      continue;
+    if (!stations[i].seen) {
+      stations[i].channel=SCAN_FREE;
+      stats.dropped++;
+    }
+    stations[i].seen=0;
+  }
+  stats.passes++;
+}
+
+void Scanner::run(uint16_t now)
+{
+  uint16_t channel;
+  uint8_t r;
+  switch (state) {
+    case SCAN_BOOT:
+    case SCAN_WAKE:       // powerup time after wakeup
+      if (radio.boot(now))
+        state=SCAN_SEEK;
+      break;
+    case SCAN_SEEK:
+      radio.seek_up();
+      state=SCAN_SEEKING;
+      break;
+    case SCAN_SEEKING:
+      r=radio.run(now);
+      if (r&RADIO_FAILED)
+        state=SCAN_SEEK;
+      if (!(r&RADIO_TUNED) || (r&RADIO_FAILED))
+        break;
+      channel=radio.get_channel();
+      if (channel<=last_channel)
+        end_pass();
+      last_channel=channel;
+      stats.found++;
+      dwell_start=now;
+      state=SCAN_DWELL;
+      break;
+    case SCAN_DWELL:
+      radio.run(now);
+      // station name is published only when complete
+      if (decoder.get_ps()[0] && decoder.get_pty()>=0)
+        stats.named++;
+      else if ((uint16_t)(now-dwell_start)<SCAN_WAIT)
+        break;
+      store();
+      state=SCAN_SEEK;
+      break;
+  }
+}
+
+// a seek in progress is stopped, chip forgets it on power down
+void Scanner::sleep()
+{
+  if (state==SCAN_OFF || state==SCAN_BOOT)
+    return;
+  if (radio.is_tuning())
+    radio.end_tune();
+  radio.sleep();
+}
+
+// seek is started again from where it was, after powerup time
+void Scanner::wakeup()
+{
+  if (state==SCAN_OFF || state==SCAN_BOOT)
+    return;
+  radio.wakeup();
+  state=SCAN_WAKE;
+}
+
+#endif
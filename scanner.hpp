@@ -0,0 +1,145 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __scanner_hpp__
+#define __scanner_hpp__
+#include <avr/io.h>
+#include <string.h>
+#include "softi2c.hpp"
+
+// background station scanner on a second Si4703, build option, rename
+// to SCANNER to enable. needs the second bus wired, see softi2c.hpp.
+// its static RAM is over the 1KB of an ATmega168, see RAM_BUDGET
+#define noSCANNER
+
+#if defined(SCANNER) && !defined(CLOCK_RC)
+#error "the scanner bus is on the crystal pins, build with CLOCK=RC"
+#endif
+
+#define SCAN_STATIONS 12      // station table size
+#define SCAN_WAIT 640         // ticks to wait for station name, 1.3s
+#define SCAN_FREE 0xffff      // channel of unused table entry
+
+struct Station
+{
+  uint16_t channel;
+  uint16_t pi;          // 0 if station has no RDS
+  uint8_t rssi;
+  int8_t pty;           // -1 if station has no RDS
+  char ps[8];           // station name, zeros if not received in time
+  uint8_t seen;         // found on current pass
+};
+
+struct ScanStats
+{
+  uint16_t passes;      // complete passes over the band
+  uint16_t found;       // stations stopped at
+  uint16_t named;       // of those, station name received
+  uint16_t replaced;    // weaker stations dropped for lack of room
+  uint16_t dropped;     // stations gone, not found on next pass
+};
+
+// stripped RDS decoder for the scanner, only what goes to the station
+// table: PI, program type and station name from groups 0A and 0B.
+// there is no radio text, no statistics and no other group types
+class ScanDecoder : public RDSReceiver
+{
+  uint16_t pi;
+  uint16_t candidate_pi; // PI of rejected group, see RDSDecoder
+  int8_t pty;
+  uint8_t ps_seen;       // bitmap of received station name segments
+  char psbuf[8];         // station name collection buf
+  char ps[8];            // station name, set when all segments are in
+
+public:
+  uint16_t get_pi() { return pi; }
+  int8_t get_pty() { return pty; }
+  const char *get_ps() { return ps; }
+
+  void decode_group(uint16_t b1,uint16_t b2,uint16_t b3,uint16_t b4);
+
+  void reset()
+  {
+    pi=0;
+    candidate_pi=0;
+    pty=-1;
+    ps_seen=0;
+    memset(psbuf,0,sizeof(psbuf));
+    memset(ps,0,sizeof(ps));
+  }
+
+  ScanDecoder() { reset(); }
+};
+
+// the scanner tuner seeks from station to station over the band and
+// waits on each one for RDS to tell its name and program type. audio
+// of the scanner chip is muted, so the tuner playing is not disturbed.
+// a station not found again on the next pass is removed from table
+//
+class Scanner
+{
+  SoftSI4703 radio;
+  ScanDecoder decoder;
+  Station stations[SCAN_STATIONS];
+  uint8_t state;
+  uint16_t last_channel;  // channel of previous station, for pass end
+  uint16_t dwell_start;
+  ScanStats stats;
+
+  enum { SCAN_OFF, SCAN_BOOT, SCAN_WAKE, SCAN_SEEK, SCAN_SEEKING, SCAN_DWELL } SCANSTATES;
+
+  void store();
+  void end_pass();
+
+public:
+
+  // to be called before the tuner on TWI is reset
+  void prepare() { SoftSI4703::hold(); }
+
+  // start scanner chip, after the other tuner has been reset. the
+  // scanner stays off if the chip does not answer
+  void init();
+
+  // advance scan, to be called on every tick while radio is on
+  void run(uint16_t now);
+
+  void sleep();
+  void wakeup();
+
+  // table entry, or NULL if entry is unused
+  const Station *get(uint8_t i)
+  {
+    return (i<SCAN_STATIONS && stations[i].channel!=SCAN_FREE)?&stations[i]:NULL;
+  }
+
+  const ScanStats *get_stats() { return &stats; }
+  const I2CErrors *get_i2c_errors() { return radio.get_i2c_errors(); }
+
+  Scanner() : state(SCAN_OFF), last_channel(0)
+  {
+    memset(stations,0xff,sizeof(stations));
+    memset(&stats,0,sizeof(stats));
+  }
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include "settings.hpp"
+
+SettingsRecord EEMEM ee_settings[SETTINGS_SLOTS];
+
+static const SettingsData defaults = {
+  9780, // Retro FM in Tallinn, Estonia
+  3,    // volume
+  0,    // channel is converted from frequency for build region
+  0,
+  { 0,0,0 }
+};
+
+// crc over all but the last byte of record. starts from 0xff, so that
+// neither erased (all 0xff) nor zero filled slots pass as valid records
+uint8_t Settings::crc(const void *r,uint8_t size)
+{
+  uint8_t i,c=0xff;
+  for (i=0;i<size-1;i++)
+    c=_crc8_ccitt_update(c,((const uint8_t*)r)[i]);
+  return c;
+}
+
+// newest valid layout 1 record, from the same EEPROM area. next write
+// starts the ring over from slot 0 in current layout
+uint8_t Settings::load_layout1()
+{
+  SettingsRecord1 r;
+  uint8_t i,found=0,seq=0;
+  for (i=0;i<SETTINGS_SLOTS;i++) {
+    eeprom_read_block(&r,(SettingsRecord1*)ee_settings+i,sizeof(r));
+    if (r.crc!=crc(&r,sizeof(r)))
+      continue;
+    if (!found || (int8_t)(r.seq-seq)>0) {
+      seq=r.seq;
+      record.data=defaults;
+      record.data.frequency=r.frequency;
+      record.data.volume=r.volume;
+      record.data.channel=r.channel;
+      record.data.flags=r.flags;
+      found=1;
+    }
+  }
+  record.seq=seq;
+  slot=SETTINGS_SLOTS-1;
+  return found;
+}
+
+// single pass over the ring, remembering the newest valid record
+void Settings::load()
+{
+  SettingsRecord r;
+  uint8_t i,found=0;
+  for (i=0;i<SETTINGS_SLOTS;i++) {
+    eeprom_read_block(&r,&ee_settings[i],sizeof(r));
+    if (r.layout!=SETTINGS_LAYOUT || r.crc!=crc(&r,sizeof(r)))
+      continue;
+    if (!found || (int8_t)(r.seq-record.seq)>0) {
+      record=r;
+      slot=i;
+      found=1;
+    }
+  }
+  if (!found && !load_layout1()) {
+    record.seq=0;
+    record.data=defaults;
+    slot=SETTINGS_SLOTS-1;
+  }
+  record.layout=SETTINGS_LAYOUT;
+  pending=record.data;
+  holdoff=0;
+}
+
+// start writing pending values to next slot in the ring. if previous
+// record is still being written, try again on next tick
+void Settings::commit()
+{
+  if (!memcmp(&pending,&record.data,sizeof(pending)))
+    return;
+  if (wpos<sizeof(record)) {
+    holdoff=1;
+    return;
+  }
+  record.seq++;
+  record.data=pending;
+  record.crc=crc(&record,sizeof(record));
+  if (++slot>=SETTINGS_SLOTS)
+    slot=0;
+  wpos=0;
+  EECR|=(1<<EERIE);
+}
+
+// bytes that already have the right value are skipped, this saves
+// both time and EEPROM wear. record goes first, queued block after it
+void Settings::isr()
+{
+  uint8_t *adr;
+  uint8_t data;
+  for (;;) {
+    if (wpos<sizeof(record)) {
+      adr=(uint8_t*)&ee_settings[slot]+wpos;
+      data=((uint8_t*)&record)[wpos++];
+    }
+    else if (bcount) {
+      adr=bdst++;
+      data=*bsrc++;
+      bcount--;
+    }
+    else
+      break;
+    EEAR=(uint16_t)adr;
+    EECR|=(1<<EERE);
+    if (EEDR!=data) {
+      EEDR=data;
+      EECR|=(1<<EEMPE);
+      EECR|=(1<<EEPE);
+      return;
+    }
+  }
+  EECR&=~(1<<EERIE);
+}
+
+void Settings::read_block(void *dst,const void *src,uint8_t count)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    eeprom_read_block(dst,src,count);
+  }
+}
+
+void Settings::write_block(const void *src,void *dst,uint8_t count)
+{
+  while (bcount);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    bsrc=(const uint8_t*)src;
+    bdst=(uint8_t*)dst;
+    bcount=count;
+  }
+  EECR|=(1<<EERIE);
+}
@@ -0,0 +1,157 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __settings_hpp__
+#define __settings_hpp__
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <string.h>
+
+#define SETTINGS_SLOTS 32             // records in EEPROM ring
+#define SETTINGS_COALESCE_TICKS 1500  // about 3 seconds of main loop ticks
+
+// persistent settings. new fields take their space from spare[], so
+// that the record size and layout stay the same and older records
+// remain readable. spare bytes are zero in records written before
+// their field was added
+struct SettingsData
+{
+  uint16_t frequency;  // 10kHz units, used if SETTINGS_CHANNEL is not set
+  uint8_t volume;
+  uint16_t channel;    // valid when SETTINGS_CHANNEL is set in flags
+  uint8_t flags;
+  uint8_t spare[3];
+};
+
+#define SETTINGS_CHANNEL 0x01 // SettingsData flags, channel is stored
+
+// one log entry in EEPROM ring. the record with highest sequence
+// number (in serial number arithmetic) and valid crc is the current one.
+// crc is the last byte written, so a write interrupted by power loss
+// leaves an invalid record and the previous one remains in effect.
+// layout changes only if the record size has to change
+struct SettingsRecord
+{
+  uint8_t seq;
+  uint8_t layout;      // SETTINGS_LAYOUT
+  SettingsData data;
+  uint8_t crc;
+};
+
+#define SETTINGS_LAYOUT 2
+
+// layout 1 record, 8 bytes without layout and spare. converted on
+// load when the ring has no current layout records
+struct SettingsRecord1
+{
+  uint8_t seq;
+  uint16_t frequency;
+  uint8_t volume;
+  uint16_t channel;
+  uint8_t flags;
+  uint8_t crc;
+};
+
+// wear leveling settings store. new values are collected to pending
+// copy, and written out as a new record after they have stayed unchanged
+// for SETTINGS_COALESCE_TICKS. values identical to last stored record
+// are never written. EEPROM writing is done one byte at a time from
+// EE_READY interrupt, so the main loop never waits for EEPROM
+//
+class Settings
+{
+  SettingsRecord record;   // last stored record, ISR writes this one out
+  SettingsData pending;    // current values
+  uint8_t slot;            // ring slot of record
+  uint16_t holdoff;        // ticks left until pending values are stored
+  volatile uint8_t wpos;   // next byte for ISR to write, sizeof(record) when idle
+  const uint8_t *bsrc;     // other EEPROM block queued for ISR,
+  uint8_t *bdst;           // written after the record
+  volatile uint8_t bcount; // bytes of block left, 0 when idle
+
+  static uint8_t crc(const void *r,uint8_t size);
+  uint8_t load_layout1();
+  void commit();
+
+public:
+
+  // find newest valid record, or load defaults if there is none
+  void load();
+
+  // call once per main loop tick
+  void run()
+  {
+    if (holdoff && !--holdoff)
+      commit();
+  }
+
+  // store pending changes now, without waiting for coalescing timeout
+  void flush()
+  {
+    holdoff=0;
+    commit();
+  }
+
+  uint8_t busy() { return wpos<sizeof(record) || bcount; }
+
+  // EEPROM access for other users of EEPROM. reading waits only for the
+  // byte currently being written. a written block is queued for the
+  // EE_READY interrupt like the record, src must stay unchanged until
+  // block_busy() is 0. a block written while previous one is still
+  // queued waits for it
+  void read_block(void *dst,const void *src,uint8_t count);
+  void write_block(const void *src,void *dst,uint8_t count);
+  uint8_t block_busy() { return bcount; }
+
+  // write next changed byte of record or block, called from EE_READY interrupt
+  void isr();
+
+  // records from before channel numbers only have the frequency,
+  // the caller converts it to a channel
+  uint8_t has_channel() { return pending.flags&SETTINGS_CHANNEL; }
+  uint16_t get_frequency() { return pending.frequency; }
+  uint16_t get_channel() { return pending.channel; }
+  uint8_t get_volume() { return pending.volume; }
+
+  void set_channel(uint16_t c)
+  {
+    if (c!=pending.channel || !has_channel()) {
+      pending.channel=c;
+      pending.flags|=SETTINGS_CHANNEL;
+      holdoff=SETTINGS_COALESCE_TICKS;
+    }
+  }
+
+  void set_volume(uint8_t v)
+  {
+    if (v!=pending.volume) {
+      pending.volume=v;
+      holdoff=SETTINGS_COALESCE_TICKS;
+    }
+  }
+
+  Settings() : slot(SETTINGS_SLOTS-1), holdoff(0), wpos(sizeof(record)), bcount(0) { }
+
+};
+
+#endif
@@ -70,6 +70,13 @@ SOFTWARE.
 #define SPACE_100    0x0010 // 100kHz (eu,jp)
 #define SPACE_50     0x0020 // 50kHz
 #define SPACE_MASK   0x0030 // channel spacing bits
+
+// register settings for build region
+#define SI_BAND ((region.min_frequency<8750)? \
+  ((region.max_frequency>9000)?BAND_JP_W:BAND_JP):BAND_EU_US)
+#define SI_SPACING ((region.spacing==20)?SPACE_200: \
+  ((region.spacing==10)?SPACE_100:SPACE_50))
+#define SI_DEEMPHASIS ((region.deemphasis==50)?DE:0)
 // SYSCONFIG3 (6)
 #define VOLEXT       0x0100 // -30dB attenuation of output volume
 #define SKSNR_MASK   0x00F0 // seek SNR threshold 
@@ -90,6 +97,28 @@ SOFTWARE.
 // READCHANNEL (11)
 #define READCHAN_MASK 0x03ff // currently set channel number
 
+// power up timing, in 2.048ms main loop ticks
+#define XOSC_TICKS    245 // 500ms for crystal oscillator to settle
+#define POWERUP_TICKS 54  // 110ms for powerup
+#define TUNE_POLLS    200 // register reads to wait for tune, a read is ~0.8ms
+#define TUNE_TICKS    64  // run() gives up a tune after 130ms, it takes 60ms
+#define SEEK_CHANNEL_TICKS 30 // and a seek after 61ms per channel in band
+
+// RDS poll scheduling. a group is 104 bits at 1187.5bps, 87.58ms or
+// 42.76 ticks, and RDSR stays set for at least 40ms (19.5 ticks) after
+// the group is ready
+#define RDS_PERIOD_256   10947 // group period in 1/256 ticks
+#define RDS_DENSE_TICKS  4     // poll interval while tuning or acquiring sync
+#define RDS_IDLE_TICKS   16    // poll interval when no RDS is received
+#define RDS_POLL_DELAY   8     // synced poll this long after expected RDSR rise
+#define RDS_HUNT_EARLY   4     // rise is looked for from this long before expected
+#define RDS_HUNT_LATE    16    // until this long after
+#define RDS_ANCHOR_GROUPS 8    // synced groups between looking for the rise
+#define RDS_LOCK_MIN     38    // edge interval range accepted for lock
+#define RDS_LOCK_MAX     47
+#define RDS_SYNC_MISSES  1     // expected groups not seen before dropping sync
+#define RDS_QUIET_POLLS  64    // dense polls without a group before idling
+
 #define RADIO_RST_HIGH() (PORTC|=0x08)
 #define RADIO_RST_LOW() (PORTC&=(~0x08))
 #define RADIO_SDA_LOW() (PORTC&=(~0x10))
@@ -104,205 +133,597 @@ class SI4703 : public BaseRadio
     RDSA=12,       RDSB=13,       RDSC=14,        RDSD=15
   } SI4307REGISTERS;
 
+  enum {
+    BOOT_XOSC, BOOT_XOSC_WAIT, BOOT_POWERUP, BOOT_POWERUP_WAIT, BOOT_DONE
+  } BOOTSTATES;
+
   uint16_t registers[16]; // 'shadow' copy of registers
+  uint8_t boot_state;
+  uint16_t boot_time;
+  uint16_t lastgroup;     // checksum of last decoded RDS group
+  uint8_t batch;          // nesting depth of open register batch
+  uint8_t dirty;          // highest register changed in batch, 0 if none
+  uint8_t shadow_valid;   // registers 2..7 are known to match the chip
+  uint8_t stc_wait;       // tune ended, STC has not been seen cleared yet
+  uint8_t generation;     // incremented on every status snapshot read
+  uint16_t snapshot_time; // tick of last scheduled snapshot read
+  uint16_t tune_start;    // tick when run() first saw the tune, 0 if not yet
+  uint16_t tune_limit;    // ticks allowed for tune or seek
+  // adaptive RDS polling
+  uint8_t rds_mode;       // RDS_DENSE, RDS_SYNC, RDS_HUNT or RDS_IDLE
+  uint8_t rds_state;      // edge detector, 1 while RDSR is high
+  uint8_t rds_count;      // misses in sync, polls without group in dense mode
+  uint8_t rds_groups;     // groups since rise was last looked for in sync
+  uint8_t rds_frac;       // fractional tick of expected group arrival
+  uint16_t rds_edge;      // tick of last rising edge seen, 0 if none. in
+                          // RDS_HUNT the tick when looking for rise ends
+  uint16_t last_run;      // tick of last run() call
+  uint16_t poll_wait;     // ticks until next status read
+
+  enum {
+    RDS_DENSE, RDS_SYNC, RDS_HUNT, RDS_IDLE
+  } RDSPOLLMODES;
 
   // read starts from upper byte of register 0x0a, address wraps to 0
-  // after lower byte of last register is read  
-  void read()
+  // after lower byte of last register is read. registers 2..7 are
+  // only written by us, so once known, the shadow copy is kept and
+  // batched changes are not lost. then only the 6 status and RDS
+  // registers are read. on bus error the register file is left as
+  // it was, and 0 is returned
+  uint8_t read()
   {
-    uint8_t i;
+    uint8_t i,n;
     uint16_t buf[16];
-    i2c_read(0x10,(uint8_t*)buf,32);
+    n=(shadow_valid || dirty)?12:32;
+    if (i2c_read(0x10,(uint8_t*)buf,n)!=n)
+      return 0;
     // swap bytes, and shift register file
     for (i=0;i<6;i++)
       registers[i+10]=(buf[i]<<8)|(buf[i]>>8);
-    for (i=6;i<16;i++)
-      registers[i-6]=(buf[i]<<8)|(buf[i]>>8);
+    if (n==32) {
+      for (i=6;i<16;i++)
+        registers[i-6]=(buf[i]<<8)|(buf[i]>>8);
+      shadow_valid=1;
+    }
+    if (!(registers[STATUSRSSI]&STC))
+      stc_wait=0;
+    generation++;
+    return 1;
+  }
+
+  // read status again if the snapshot is more than maxage ticks old
+  void refresh(uint16_t now,uint16_t maxage)
+  {
+    if ((uint16_t)(now-snapshot_time)>maxage) {
+      snapshot_time=now;
+      read();
+    }
+  }
+
+  // mark shadow register changed, to be written at end of batch
+  void changed(uint8_t reg)
+  {
+    if (reg>dirty)
+      dirty=reg;
   }
   
   // write starts from upper byte of register 0x02 and
   // address wraps to 0 after reading lower byte of last
-  // register, but only registers 2..7 are interesting
-  void write()
+  // register, but only registers 2..7 are interesting.
+  // count is the number of registers to write, starting from 2.
+  // if the write fails the chip state is unknown, so shadow
+  // registers are read back on next read()
+  uint8_t write(uint8_t count=6)
   {
     uint8_t i;
     uint16_t buf[6];
-    for (i=0;i<6;i++)
+    for (i=0;i<count;i++)
       buf[i]=(registers[i+2]<<8)|(registers[i+2]>>8);
-    i2c_write(0x10,(uint8_t*)buf,12);
+    if (i2c_write(0x10,(uint8_t*)buf,count*2)!=count*2) {
+      shadow_valid=0;
+      return 0;
+    }
+    return 1;
+  }
+
+protected:
+
+  // reset pulse with SDIO low selects 2-wire bus mode
+  virtual void chip_reset()
+  {
+    RADIO_SDA_LOW(); RADIO_RST_LOW(); _delay_ms(1);
+    RADIO_RST_HIGH(); _delay_ms(1); RADIO_SDA_HIGH();
+  }
+
+  // while run() is polling, keep other devices off the bus in the tick
+  // before a status read is due
+  uint8_t bus_wanted(uint16_t now)
+  {
+    return (uint16_t)(now-last_run)<=1 && poll_wait<=1;
   }
 
-  
 public:
 
   const char *name() { return "Si4703"; }
 
+  // open a batch of register changes. setters called before matching
+  // commit() only change shadow registers, and commit() writes all of
+  // them with one transfer. the registers are read from the chip only
+  // if they are not known yet. batches can be nested
+  void begin()
+  {
+    if (!batch++ && !shadow_valid)
+      read();
+  }
+
+  void commit()
+  {
+    if (--batch)
+      return;
+    if (dirty) {
+      write(dirty-1);
+      dirty=0;
+    }
+  }
+
+  // wait for tune to complete, bounded so that a chip that stops
+  // responding does not stall until watchdog reset
+  uint8_t wait_ready()
+  {
+    uint8_t n=TUNE_POLLS;
+    while (!is_ready())
+      if (!--n) {
+        end_tune();
+        return 0;
+      }
+    return 1;
+  }
+
   uint8_t is_ready()
   {
     read();
     if (registers[STATUSRSSI]&STC) // if seek/tune completed
     {
       registers[CHANNEL]&=~(TUNE); // stop tuning
-      write();
+      write(2);
+      stc_wait=1;
       return 1;
     }
     return 0;
   }
 
-  uint16_t channel_spacing(void)
+  uint16_t channel_spacing(void) { return region.spacing; }
+    
+  // channel number for frequency, frequency is limited to band
+  uint16_t frequency_channel(int32_t f)
   {
-    switch (registers[SYSCONFIG2]&SPACE_MASK)
-    {
-      case SPACE_200:
-        return 20;
-      case SPACE_100:
-        return 10;
-      case SPACE_50:
-        return 5;
-    }
-    return 10;
+    if (f<region.min_frequency)
+      f=region.min_frequency;
+    if (f>region.max_frequency)
+      f=region.max_frequency;
+    return (uint16_t)(f-region.min_frequency)/region.spacing;
   }
-    
+
   // start setting new frequency
   void set_frequency(int32_t f)
   {
-    if (f < get_min_frequency())
-      f=get_min_frequency();
-    if (f> get_max_frequency())
-      f=get_max_frequency();
-    f = (f-get_min_frequency())/channel_spacing();
-    read();
-    registers[CHANNEL]&=~(CHANNEL_MASK); // clear out the channel bits
-    registers[CHANNEL]|=f;    // set new channel
-    registers[CHANNEL]|=TUNE; // set the TUNE bit to start
-    write();
-    while (!is_ready());
+    set_channel(frequency_channel(f));
+  }
+
+  // tune to channel and wait until done. inside a batch the tuning
+  // starts at commit() and run() completes it
+  void set_channel(uint16_t channel)
+  {
+    tune_channel(channel);
+    if (batch)
+      return;
+    wait_ready();
     if (decoder)              // if decoder is enabled, then flush it
       decoder->reset();
   }
 
-  int32_t get_min_frequency()
+  // start tuning to channel and return without waiting for completion.
+  // only POWERCFG and CHANNEL registers are sent, run() finishes tuning
+  // when seek/tune complete is seen
+  void tune_channel(uint16_t channel)
+  {
+    uint8_t n;
+    if (registers[POWERCFG]&SEEK) // abort seek in progress
+      end_tune();
+    else if (registers[CHANNEL]&TUNE) // previous tune still in progress
+      wait_ready();
+    for (n=TUNE_POLLS;stc_wait && n;n--) // STC must clear before next tune
+      read();
+    begin();
+    registers[CHANNEL]&=~(CHANNEL_MASK);
+    registers[CHANNEL]|=channel|TUNE;
+    changed(CHANNEL);
+    commit();
+    tune_start=0;
+    tune_limit=TUNE_TICKS;
+    resync();
+  }
+
+  // start seeking, run() finishes it when seek/tune complete is seen
+  void seek(uint8_t up)
+  {
+    uint8_t n;
+    if (is_tuning())
+      return;
+    for (n=TUNE_POLLS;stc_wait && n;n--) // STC must clear before seek
+      read();
+    begin();
+    if (up)
+      registers[POWERCFG]|=SEEKUP;
+    else
+      registers[POWERCFG]&=~(SEEKUP);
+    registers[POWERCFG]|=SEEK;
+    changed(POWERCFG);
+    commit();
+    tune_start=0;
+    tune_limit=(region_max_channel+1)*SEEK_CHANNEL_TICKS;
+    resync();
+    if (decoder)
+      decoder->reset();
+  }
+
+  void seek_up() { seek(1); }
+  void seek_down() { seek(0); }
+
+  // clear TUNE and SEEK bits after seek/tune complete
+  void end_tune()
+  {
+    registers[CHANNEL]&=~(TUNE);
+    registers[POWERCFG]&=~(SEEK);
+    write(2);
+    stc_wait=1;
+    resync();
+  }
+
+  // group timing is unknown, go back to dense polling
+  void resync()
+  {
+    rds_mode=RDS_DENSE;
+    rds_state=0;
+    rds_count=0;
+    rds_edge=0;
+    poll_wait=0;
+  }
+
+  // ticks from one expected group arrival to next, 42 or 43
+  uint8_t rds_period()
+  {
+    uint16_t f=rds_frac+(RDS_PERIOD_256&0xff);
+    rds_frac=f;
+    return (RDS_PERIOD_256>>8)+(f>>8);
+  }
+
+  uint8_t is_tuning() { return ((registers[CHANNEL]&TUNE)||(registers[POWERCFG]&SEEK))?1:0; }
+
+  // shadow register file, as of last read
+  const uint16_t *get_registers() { return registers; }
+
+  // status getters return values from last snapshot without bus
+  // traffic. if maxage is given, the snapshot is read again when
+  // it is older than that at tick now
+  uint16_t get_channel(uint16_t now=0,uint16_t maxage=ANY_AGE)
   {
-    return (registers[SYSCONFIG2]&BAND_MASK)?7600:8750;
+    refresh(now,maxage);
+    return registers[READCHAN]&READCHAN_MASK;
   }
+
+  // frequency in 10kHz units, fits in 16 bits for all bands
+  uint16_t channel_frequency(uint16_t channel)
+  {
+    return (channel*region.spacing)+region.min_frequency;
+  }
+
+  uint16_t get_max_channel() { return region_max_channel; }
   
-  int32_t get_frequency()
+  int32_t get_frequency(uint16_t now=0,uint16_t maxage=ANY_AGE)
   {
-    read();
-    int32_t channel=registers[READCHAN]&READCHAN_MASK;
-    channel=(channel*channel_spacing())+get_min_frequency();
-    return channel;
+    refresh(now,maxage);
+    return channel_frequency(registers[READCHAN]&READCHAN_MASK);
   }
   
   // status
-  uint8_t is_tuned() { return is_ready(); };
-  uint8_t is_stereo() { return (registers[STATUSRSSI]&SI)?1:0; };
-  uint8_t get_rssi() { return registers[STATUSRSSI]&RSSI_MASK; };
+  uint8_t is_tuned(uint16_t now=0,uint16_t maxage=ANY_AGE)
+  {
+    refresh(now,maxage);
+    return ((registers[STATUSRSSI]&STC) || !is_tuning())?1:0;
+  }
+
+  uint8_t is_stereo(uint16_t now=0,uint16_t maxage=ANY_AGE)
+  {
+    refresh(now,maxage);
+    return (registers[STATUSRSSI]&SI)?1:0;
+  }
+
+  uint8_t get_rssi(uint16_t now=0,uint16_t maxage=ANY_AGE)
+  {
+    refresh(now,maxage);
+    return registers[STATUSRSSI]&RSSI_MASK;
+  }
+
+  // changes every time a new snapshot is read
+  uint8_t get_generation() { return generation; }
 
   uint8_t is_connected()
   {
-    read();
+    if (!read())
+      return 0;
     return ((registers[DEVICEID]&0xfff)==0x242 &&
        (((registers[CHIPID]>>6)&0x0f)==8 ||
        ((registers[CHIPID]>>6)&0x0f)==9));
   }
 
-  // do recurring processing, such as decoding RDS. Also refreshes register file
-  void run(void)
+  // do recurring processing, such as decoding RDS. to be called on
+  // every tick, the status snapshot is read only when a poll is due.
+  //
+  // polling is dense after a retune, until two rising edges of RDSR
+  // one group apart are seen. then the radio is read once per group,
+  // RDS_POLL_DELAY after the expected rise, which is well inside the
+  // 19.5 tick RDSR high time. the tick and group clocks drift apart,
+  // by RC clock error and by ticks that are served late, so every
+  // RDS_ANCHOR_GROUPS groups the radio is read on every tick from
+  // RDS_HUNT_EARLY before the expected rise until it is seen, and the
+  // timing is taken from there. a synced read that finds no group
+  // also looks for the rise on every tick, until RDS_HUNT_LATE after
+  // it was expected. only if the group is not found then either (bad
+  // reception), sync is dropped after RDS_SYNC_MISSES and dense
+  // polling takes over. with no RDS at all the poll slows down to
+  // RDS_IDLE_TICKS, still shorter than RDSR high time so no group is
+  // lost
+  uint8_t run(uint16_t now)
   {
-    static uint8_t state=0;
-    uint8_t r;
-    if (decoder) {
-      read();
-      // RDS ready bit stays set for at least 40ms when group received, but we only
-      // want to process each group once, so need to do edge detection logic
-      //
-      r=(registers[STATUSRSSI]&RDSR)?1:0;
-      switch (state)
-      {
-        case 0: // waiting for positive edge
-          if (r) {
-            state=1;
-            decoder->decode_group(registers[RDSA],registers[RDSB],registers[RDSC],registers[RDSD]);
-          }
-          break;
-        case 1: // waiting for falling edge
-          if (!r)
-            state=0;
-          break;
-        default:
-          state=0;
-          break;
+    uint16_t elapsed=now-last_run;
+    uint16_t late;
+    uint8_t r,result=0;
+    last_run=now;
+    if (poll_wait>elapsed) {
+      poll_wait-=elapsed;
+      return 0;
+    }
+    late=elapsed-poll_wait;
+    poll_wait=RDS_DENSE_TICKS;
+    snapshot_time=now;
+    if (!read() && !is_tuning()) // a tune is timed also if reads fail
+      return 0;
+    if (is_tuning()) {   // tune_channel() or seek in progress
+      if (registers[STATUSRSSI]&STC) {
+        end_tune();
+        return RADIO_TUNED;
+      }
+      // STC does not come if the chip lost power or missed the
+      // write, or reads fail. the registers are read again on
+      // next batch
+      if (!tune_start)
+        tune_start=now|1;
+      else if ((uint16_t)(now-tune_start)>=tune_limit) {
+        end_tune();
+        shadow_valid=0;
+        return RADIO_TUNED|RADIO_FAILED;
       }
+      return 0;
     }
+    if (!decoder) {
+      poll_wait=RDS_IDLE_TICKS;
+      return 0;
+    }
+    r=(registers[STATUSRSSI]&RDSR)?1:0;
+    if (rds_mode==RDS_SYNC) {
+      // one poll per group, so RDSR high is always a new group
+      if (!r) {
+        // late, or the chip did not receive it
+        rds_mode=RDS_HUNT;
+        rds_state=0;
+        rds_edge=now-late-RDS_POLL_DELAY+RDS_HUNT_LATE;
+        poll_wait=1;
+        return 0;
+      }
+      rds_count=0;
+      lastgroup=registers[RDSB]+registers[RDSC]+registers[RDSD];
+      decoder->decode_group(registers[RDSA],registers[RDSB],registers[RDSC],registers[RDSD]);
+      r=rds_period();
+      if (++rds_groups>=RDS_ANCHOR_GROUPS) {
+        // RDSR of this group may still be high when looking starts
+        rds_mode=RDS_HUNT;
+        rds_state=1;
+        rds_edge=now-late-RDS_POLL_DELAY+r+RDS_HUNT_LATE;
+        r-=RDS_POLL_DELAY+RDS_HUNT_EARLY;
+      }
+      poll_wait=(r>late)?r-late:0;
+      return RADIO_GROUP;
+    }
+    if (rds_mode==RDS_HUNT) {
+      if (r && (!rds_state ||
+        lastgroup!=(uint16_t)(registers[RDSB]+registers[RDSC]+registers[RDSD]))) {
+        lastgroup=registers[RDSB]+registers[RDSC]+registers[RDSD];
+        decoder->decode_group(registers[RDSA],registers[RDSB],registers[RDSC],registers[RDSD]);
+        // the rise was between previous run() and now, assume the
+        // middle of that and schedule next poll from there. if RDSR
+        // was already high, the rise was earlier, by drift of more
+        // than RDS_HUNT_EARLY. then the timing is moved that much
+        // earlier, and the rise looked for again on next group
+        rds_mode=RDS_SYNC;
+        rds_count=0;
+        rds_groups=rds_state?RDS_ANCHOR_GROUPS-1:0;
+        rds_frac=(elapsed&1)?128:0;
+        poll_wait=rds_period()+RDS_POLL_DELAY-(elapsed+1)/2-(rds_state?RDS_HUNT_EARLY:0);
+        return RADIO_GROUP;
+      }
+      rds_state=r;
+      poll_wait=1;
+      if ((int16_t)(now-rds_edge)<0)
+        return 0;
+      // not there, the group was lost
+      if (++rds_count>=RDS_SYNC_MISSES) {
+        resync();
+        return 0;
+      }
+      rds_mode=RDS_SYNC;
+      late=now-rds_edge;
+      r=rds_period()+RDS_POLL_DELAY-RDS_HUNT_LATE;
+      poll_wait=(r>late)?r-late:0;
+      return 0;
+    }
+    if (rds_mode==RDS_IDLE)
+      poll_wait=RDS_IDLE_TICKS;
+    // RDS ready bit stays set for at least 40ms when group received, but we only
+    // want to process each group once, so need to do edge detection logic
+    //
+    // if the group changes while waiting for falling edge, then the
+    // edge was missed between polls
+    //
+    switch (rds_state)
+    {
+      case 0: // waiting for positive edge
+        if (r) {
+          rds_state=1;
+          lastgroup=registers[RDSB]+registers[RDSC]+registers[RDSD];
+          decoder->decode_group(registers[RDSA],registers[RDSB],registers[RDSC],registers[RDSD]);
+          result=RADIO_GROUP;
+          rds_count=0;
+          if (rds_mode==RDS_IDLE)
+            rds_mode=RDS_DENSE;
+          else if (rds_edge && (uint16_t)(now-rds_edge)>=RDS_LOCK_MIN &&
+            (uint16_t)(now-rds_edge)<=RDS_LOCK_MAX) {
+            // the rise was between previous poll and now, assume the
+            // middle of that and schedule next poll from there
+            rds_mode=RDS_SYNC;
+            rds_frac=0;
+            rds_groups=RDS_ANCHOR_GROUPS-1; // refine from next group
+            poll_wait=rds_period()-RDS_DENSE_TICKS/2+RDS_POLL_DELAY;
+          }
+          rds_edge=now|1; // never 0
+        }
+        else if (rds_mode==RDS_DENSE && ++rds_count>=RDS_QUIET_POLLS)
+          rds_mode=RDS_IDLE;
+        break;
+      case 1: // waiting for falling edge
+        if (!r)
+          rds_state=0;
+        else if (lastgroup!=(uint16_t)(registers[RDSB]+registers[RDSC]+registers[RDSD])) {
+          lastgroup=registers[RDSB]+registers[RDSC]+registers[RDSD];
+          decoder->missed_group();
+          decoder->decode_group(registers[RDSA],registers[RDSB],registers[RDSC],registers[RDSD]);
+          result=RADIO_GROUP;
+        }
+        break;
+      default:
+        rds_state=0;
+        break;
+    }
+    return result;
   }
     
+  // reset the radio and start crystal oscillator. the rest of power up
+  // sequence is done by boot(), so that other initialization can be done
+  // while oscillator settles
   void init()
   {
-    // reset radio, and set I2C communiction mode
-    RADIO_SDA_LOW(); RADIO_RST_LOW(); _delay_ms(1);
-    RADIO_RST_HIGH(); _delay_ms(1); RADIO_SDA_HIGH();
+    chip_reset();
+    shadow_valid=0;
     read();
     registers[TEST1]|=XOSCEN;               // enable xtal oscillator
     write();
-    _delay_ms(500);
-    // reset complete
-    read();
-    registers[POWERCFG]=ENABLE;             // enable powerup
-    registers[SYSCONFIG1]|=RDS;             // enable RDS
-    registers[SYSCONFIG1]|=BLEND3;          // readily switch to stereo
-    // the below two lines need to be changed for
-    // country specific parameters
-    registers[SYSCONFIG1]|=DE;              // 50kHz Europe setup
-    registers[SYSCONFIG2]|=SPACE_100;       // 100kHz channel spacing for Europe
-    //
-    registers[SYSCONFIG2]&=~(VOLUME_MASK);  // mute volume
-    // configure seek settings, although seeking is not implemented
-    registers[SYSCONFIG2]|=SEEKTH_INIT;     // set initial seek threshold  
-    registers[SYSCONFIG3]&=~(SKSNR_MASK);   // prepare to override SNR
-    registers[SYSCONFIG3]&=~(SKCNT_MASK);   // and FM impulse detection thresholds
-    registers[SYSCONFIG3]|=SKSNR_INIT;      // set new values
-    registers[SYSCONFIG3]|=SKCNT_INIT;      // for both
-    write();
-    _delay_ms(110);
-  } 
+    boot_state=BOOT_XOSC;
+  }
 
+  // advance power up sequence, to be called on every tick with current
+  // tick count. returns 1 when the radio is powered up and can be tuned.
+  // also after wakeup()
+  uint8_t boot(uint16_t now)
+  {
+    switch (boot_state)
+    {
+      case BOOT_XOSC:
+        boot_time=now;
+        boot_state=BOOT_XOSC_WAIT;
+        break;
+      case BOOT_POWERUP:
+        boot_time=now;
+        boot_state=BOOT_POWERUP_WAIT;
+        break;
+      case BOOT_XOSC_WAIT:
+        if ((uint16_t)(now-boot_time)<XOSC_TICKS)
+          break;
+        // reset complete
+        read();
+        // enable powerup, soft mute enabled and stereo allowed
+        registers[POWERCFG]=ENABLE;
+        registers[SYSCONFIG1]|=RDS;             // enable RDS
+        registers[SYSCONFIG1]|=BLEND3;          // readily switch to stereo
+        registers[SYSCONFIG1]|=SI_DEEMPHASIS;   // band for build region
+        registers[SYSCONFIG2]|=SI_BAND|SI_SPACING;
+        registers[SYSCONFIG2]&=~(VOLUME_MASK);  // mute volume
+        // configure seek settings
+        registers[SYSCONFIG2]|=SEEKTH_INIT;     // set initial seek threshold
+        registers[SYSCONFIG3]&=~(SKSNR_MASK);   // prepare to override SNR
+        registers[SYSCONFIG3]&=~(SKCNT_MASK);   // and FM impulse detection thresholds
+        registers[SYSCONFIG3]|=SKSNR_INIT;      // set new values
+        registers[SYSCONFIG3]|=SKCNT_INIT;      // for both
+        write();
+        boot_time=now;
+        boot_state=BOOT_POWERUP_WAIT;
+        break;
+      case BOOT_POWERUP_WAIT:
+        if ((uint16_t)(now-boot_time)>=POWERUP_TICKS)
+          boot_state=BOOT_DONE;
+        break;
+      case BOOT_DONE:
+        return 1;
+    }
+    return 0;
+  }
+
+  // the chip may change POWERCFG on power down, so registers
+  // are read again on next batch
   void sleep()
   {
-    read();
+    begin();
     registers[POWERCFG]|=ENABLE;
     registers[POWERCFG]|=DISABLE;
-    write();
+    changed(POWERCFG);
+    commit();
+    shadow_valid=0;
   }
   
+  // the chip can be tuned after powerup time, when boot() returns 1.
+  // not to be batched with tuning
   void wakeup()
   {
-    read();
+    begin();
     registers[POWERCFG]&=~(DISABLE);
     registers[POWERCFG]|=ENABLE;
-    write();
+    changed(POWERCFG);
+    commit();
+    boot_state=BOOT_POWERUP;
+    resync();
     if (decoder)
       decoder->reset();
   }
 
   void set_mono(uint8_t onoff)
   {
-    read();
+    begin();
     if (onoff)
       registers[POWERCFG]|=MONO;
     else
       registers[POWERCFG]&=~(MONO);
-    write();
+    changed(POWERCFG);
+    commit();
   };
   
   void set_soft_mute(uint8_t onoff)
   {
-    read();
+    begin();
     if (onoff)
       registers[POWERCFG]&=~(DSMUTE);
     else
       registers[POWERCFG]|=DSMUTE;
-    write();              
+    changed(POWERCFG);
+    commit();
   };
 
   // set volume to 0..15
@@ -310,18 +731,21 @@ public:
   {
     if (volume > 15)
       volume = 15;
-    read();
+    begin();
     registers[SYSCONFIG2]&=~(VOLUME_MASK); // clear volume bits
     registers[SYSCONFIG2]|=volume;         // set new volume
     if (!volume)                           // at zero volume also mute
       registers[POWERCFG]&=~(DMUTE);
     else
       registers[POWERCFG]|=DMUTE;
-    write();
+    changed(SYSCONFIG2);
+    commit();
   }
   
-  SI4703() 
+  SI4703() : boot_state(BOOT_DONE), batch(0), dirty(0),
+    shadow_valid(0), stc_wait(0), last_run(0)
   {
+    resync();
   }
   
 };
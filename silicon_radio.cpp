@@ -28,27 +28,73 @@ SOFTWARE.
 #include <avr/eeprom.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
+#include <util/atomic.h>
 
 #include "si4703.hpp"
 #include "display.hpp"
 #include "meter.hpp"
+#include "ptyseek.hpp"
+#include "scanner.hpp"
+#include "events.hpp"
 #include "encoder.hpp"
+#include "settings.hpp"
+#include "presets.hpp"
+#include "telemetry.hpp"
+#include "frequency.hpp"
+#include "stack.hpp"
 
-uint16_t EEMEM ee_frequency = 9780; // Retro FM in Tallinn, Estonia
-uint16_t frequency;
+uint16_t channel;
+FrequencyBCD frequency;  // channel as decimal digits for display
+volatile uint16_t ticks; // 2.048ms timer ticks since start
+volatile uint8_t tick_posted; // EV_TICK in queue, not dispatched yet
+uint16_t boot_ticks;     // ticks from start until first tune completed
+uint16_t overruns;       // main loop iterations that took longer than a tick
 
 VU_Meter meter;
 SI4703 radio;
 RDSDecoder decoder;
 Display display;
 Encoder encoder;
+Settings settings;
+Presets presets(&settings);
+PTYSeek ptyseek(&radio,&decoder);
+#ifdef TMC
+TMCStore tmc;
+#endif
+#ifdef SCANNER
+Scanner scanner;
+#endif
+
+// event time stamp in 32us steps, called with interrupts disabled
+static uint16_t stamp()
+{
+  return (ticks<<6)|(TCNT0&0x3f);
+}
+
+uint16_t get_stamp()
+{
+  uint16_t t;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t=stamp();
+  }
+  return t;
+}
+
+uint16_t get_ticks()
+{
+  uint16_t t;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t=ticks;
+  }
+  return t;
+}
 
 // baseradio defines some pure virtuals, so we need to
 // create a handler for this
 extern "C" void __cxa_pure_virtual()
 {
   display.clear();
-  display.puts("Purevirt");
+  display.puts("PUREVIRT");
   while (1); // we'll suffer horrible death by watchdog in few seconds 
 }
 
@@ -59,23 +105,19 @@ enum DISPLAY_STATES { SKIP, SHOW, SCROLL };
 // go to endless loop
 uint8_t display_frequency()
 {
-  display.clear();
-  int32_t f=radio.get_frequency()/10;
-  if (f<1000)
-    display.putc(' ');
-  display.putn(f/10);
-  display.putc('.');
-  display.putn(f%10);
-  display.putc(' ');
+  char s[9];
+  frequency.format(s);
+  s[5]=' ';
   if (radio.is_stereo()) {
-    display.putc('S');
-    display.putc('T');
+    s[6]='S';
+    s[7]='T';
   }
   else {
-    display.putc('M');
-    display.putc(' ');
+    s[6]='M';
+    s[7]=' ';
   }
-  display.refresh();
+  s[8]='\0';
+  display.puts(s);
   return SHOW;
 }
 
@@ -88,8 +130,41 @@ uint8_t display_station()
   return SKIP;
 }
 
+#ifdef RTPLUS
+// copy RT+ tag, 0 title or 1 artist, from radio text to s, at most
+// room characters.
+// returns characters copied
+static uint8_t rtplus_tag(char *s,uint8_t tag,uint8_t room)
+{
+  uint8_t start,len;
+  const char *rt=decoder.get_rt();
+  if (!decoder.get_tag(tag,&start,&len) || strnlen(rt,64)<start+len)
+    return 0;
+  if (len>room)
+    len=room;
+  memcpy(s,rt+start,len);
+  return len;
+}
+#endif
+
+// "ARTIST - TITLE" when RT+ tags are known, full text otherwise
 uint8_t display_radiotext()
 {
+#ifdef RTPLUS
+  char s[65];
+  uint8_t n,t;
+  n=rtplus_tag(s,1,40);
+  if (n) {
+    memcpy(s+n," - ",3);
+    n+=3;
+  }
+  t=rtplus_tag(s+n,0,64-n);
+  if (t) {
+    s[n+t]='\0';
+    display.puts(s);
+    return SCROLL;
+  }
+#endif
   if (*decoder.get_rt()) {
     display.puts(decoder.get_rt());
     return SCROLL;
@@ -107,88 +182,366 @@ uint8_t (*displayfunctions[])() = {
   NULL
 };
 
-// this handles encoder inputs and different display modes
-//
-void radio_display(uint8_t reset=0)
+// new channel from preset, seek or host command. the frequency digits
+// are converted once here, tuning steps then update them incrementally
+void set_channel(uint16_t c)
 {
-static uint8_t state=0,func=0,r;
-static uint16_t count=0;
-int8_t i;
-  if (reset) {
-    func=0;
-    state=0;
+  channel=c;
+  frequency.set(radio.channel_frequency(c));
+  settings.set_channel(c);
+}
+
+// show preset message such as "P1 SAVED"
+void display_preset(uint8_t n,const char *msg)
+{
+  display.clear();
+  display.putc('P');
+  display.putc('1'+n);
+  display.putc(' ');
+  while (*msg)
+    display.putc(*msg++);
+  display.refresh();
+}
+
+// tune to preset n. the stored station name is shown right away and
+// the decoder is told which PI to expect, so there is no need to wait
+// for RDS. returns 0 if preset is empty or its channel is not in the
+// band, saved under other REGION
+uint8_t recall_preset(uint8_t n)
+{
+  Preset p;
+  if (!presets.load(n,&p) || p.channel>radio.get_max_channel()) {
+    display_preset(n,"EMPTY");
+    return 0;
+  }
+  radio.tune_channel(p.channel);
+  decoder.prime(p.pi,p.ps);
+  set_channel(p.channel);
+  return 1;
+}
+
+void store_preset(uint8_t n)
+{
+  Preset p;
+  p.channel=radio.get_channel();
+  p.pi=decoder.get_pi();
+  memcpy(p.ps,decoder.get_ps(),sizeof(p.ps));
+  presets.store(n,&p);
+  display_preset(n,"SAVED");
+}
+
+#ifdef TELEMETRY
+void send_telemetry()
+{
+  TelemetryRecord t;
+  t.ticks=get_ticks();
+  t.frequency=radio.channel_frequency(channel);
+  t.rssi=radio.get_rssi();
+  t.flags=(radio.is_stereo()?TM_STEREO:0)|(radio.is_tuning()?TM_TUNING:0);
+  t.pi=decoder.get_pi();
+  t.overruns=overruns;
+  t.boot_ticks=boot_ticks;
+  t.meter_lost=display.get_lost();
+  t.headroom=stack_headroom();
+  t.static_ram=static_ram();
+  Telemetry::send(FRAME_TELEMETRY,&t,sizeof(t));
+}
+
+// execute a batch of commands from host, and acknowledge with
+// the number of commands executed. execution stops at first
+// unknown or truncated command
+void execute_commands(const uint8_t *p,uint8_t len)
+{
+  const uint8_t *end=p+len;
+  uint8_t n=0;
+  uint16_t f;
+  while (p<end) {
+    switch (*p++) {
+      case CMD_TUNE:
+        if (end-p<2)
+          goto done;
+        f=p[0]|(p[1]<<8);
+        p+=2;
+        set_channel(radio.frequency_channel(f));
+        ptyseek.cancel();
+        radio.tune_channel(channel);
+        decoder.reset();
+        break;
+      case CMD_VOLUME:
+        if (end-p<1)
+          goto done;
+        radio.set_volume(*p);
+        settings.set_volume(*p++);
+        break;
+      case CMD_SEEK:
+        if (end-p<1)
+          goto done;
+        ptyseek.cancel();
+        if (*p++)
+          radio.seek_up();
+        else
+          radio.seek_down();
+        break;
+      case CMD_DUMP:
+        Telemetry::send(FRAME_REGISTERS,radio.get_registers(),32);
+        break;
+      case CMD_PTYSEEK:
+        if (end-p<2)
+          goto done;
+        ptyseek.start(p[0],p[1]);
+        p+=2;
+        break;
+      case CMD_PTYSTATS:
+        Telemetry::send(FRAME_PTYSTATS,ptyseek.get_stats(),sizeof(PTYStats));
+        break;
+      case CMD_EVENTSTATS:
+        Telemetry::send(FRAME_EVENTSTATS,Events::get_stats(),sizeof(EventStats));
+        break;
+#ifdef SCANNER
+      case CMD_STATION:
+        if (end-p<1)
+          goto done;
+        if (scanner.get(p[0])) {
+          uint8_t buf[1+sizeof(Station)];
+          buf[0]=p[0];
+          memcpy(buf+1,scanner.get(p[0]),sizeof(Station));
+          Telemetry::send(FRAME_STATION,buf,sizeof(buf));
+        }
+        p++;
+        break;
+      case CMD_SCANSTATS: {
+          uint8_t buf[sizeof(ScanStats)+sizeof(I2CErrors)];
+          memcpy(buf,scanner.get_stats(),sizeof(ScanStats));
+          memcpy(buf+sizeof(ScanStats),scanner.get_i2c_errors(),sizeof(I2CErrors));
+          Telemetry::send(FRAME_SCANSTATS,buf,sizeof(buf));
+        }
+        break;
+#endif
+#ifdef I2CTRACE
+      case CMD_I2CTRACE: {
+          uint8_t buf[sizeof(I2CTraceTotals)+sizeof(I2CErrors)+sizeof(i2c_trace.ring)];
+          uint8_t *q=buf,i;
+          memcpy(q,&i2c_trace.totals,sizeof(I2CTraceTotals));
+          q+=sizeof(I2CTraceTotals);
+          memcpy(q,radio.get_i2c_errors(),sizeof(I2CErrors));
+          q+=sizeof(I2CErrors);
+          for (i=0;i<I2C_TRACE_SIZE;i++,q+=sizeof(I2CTraceEntry))
+            memcpy(q,&i2c_trace.ring[(i2c_trace.head+i)&(I2C_TRACE_SIZE-1)],sizeof(I2CTraceEntry));
+          Telemetry::send(FRAME_I2CTRACE,buf,sizeof(buf));
+        }
+        break;
+#endif
+#ifdef TMC
+      case CMD_TMCSTATS:
+        Telemetry::send(FRAME_TMCSTATS,tmc.get_stats(),sizeof(TMCStats));
+        break;
+#endif
+#ifdef RDSSTATS
+      case CMD_RDSSTATS:
+        Telemetry::send(FRAME_RDSSTATS,decoder.get_stats(),sizeof(RDSStats));
+        break;
+#endif
+      default:
+        goto done;
+    }
+    n++;
+  }
+done:
+  Telemetry::send(FRAME_ACK,&n,1);
+}
+
+// handle received frames, and send telemetry records periodically
+void run_telemetry()
+{
+  static uint8_t count=0;
+  const uint8_t *p;
+  uint8_t type,len;
+  if ((p=Telemetry::receive(&type,&len))) {
+    if (type==FRAME_COMMANDS)
+      execute_commands(p,len);
+    Telemetry::done();
+  }
+  if (++count>=TELEMETRY_INTERVAL) {
+    send_telemetry();
     count=0;
   }
-  else
-    count++;
-  i=encoder.read_encoder();
+}
+#endif
+
+static uint8_t dstate,dfunc; // display function and its state
+static uint16_t dcount;      // ticks in display state
+
+// encoder turned by one detent
+void encoder_turned(int8_t i)
+{
+  if (encoder.button_down()) {
+    // turning with button down seeks for next station with the same
+    // program type as current one, or any station if there is no RDS
+    encoder.cancel_press();
+    if (!ptyseek.start(decoder.get_pty(),i>0)) {
+      if (i>0)
+        radio.seek_up();
+      else
+        radio.seek_down();
+    }
+    return;
+  }
+  ptyseek.cancel();
   switch (i) {
     case 1:
-      if (frequency<radio.get_max_frequency()) {
-        frequency=frequency+10;
-        radio.set_frequency(frequency);
-        func=0;
-        state=0;
+      if (channel<region_max_channel) {
+        channel++;
+        radio.set_channel(channel);
+        settings.set_channel(channel);
+        frequency.step(region.spacing,1);
+        dfunc=0;
+        dstate=0;
       }
       break;
     case -1:
-      if (frequency>radio.get_min_frequency()) {
-        frequency=frequency-10;
-        radio.set_frequency(frequency);
-        func=0;
-        state=0;
+      if (channel>0) {
+        channel--;
+        radio.set_channel(channel);
+        settings.set_channel(channel);
+        frequency.step(region.spacing,-1);
+        dfunc=0;
+        dstate=0;
       }
       break;
   }
-  if (encoder.read_button())
-    eeprom_write_word(&ee_frequency,frequency);
-  meter.stop();
-  while (!state) { // find next function with output
-    count=0;
-    if (displayfunctions[func]==NULL)
-      func=0;
-    r=displayfunctions[func++]();
+}
+
+// debounced button press
+void button_pressed(int8_t press)
+{
+  switch (press) {
+    case SHORT_PRESS: // step to next preset
+      ptyseek.cancel();
+      if (recall_preset(presets.next())) {
+        dfunc=1;      // start from station name
+        dstate=0;
+      }
+      else {
+        dfunc=0;
+        dstate=1;
+      }
+      dcount=0;
+      break;
+    case LONG_PRESS:  // store current station to current preset
+      store_preset(presets.get_current());
+      dfunc=0;
+      dstate=1;
+      dcount=0;
+      break;
+  }
+}
+
+// this handles different display modes, called on every tick
+//
+void radio_display(uint8_t reset=0)
+{
+uint8_t r;
+  if (reset) {
+    dfunc=0;
+    dstate=0;
+    dcount=0;
+  }
+  else
+    dcount++;
+  while (!dstate) { // find next function with output
+    dcount=0;
+    if (displayfunctions[dfunc]==NULL)
+      dfunc=0;
+    r=displayfunctions[dfunc++]();
     if (r==SHOW)
-      state=1;
+      dstate=1;
     if (r==SCROLL)
-      state=2;      
+      dstate=2;      
   }
-  switch (state) {
+  switch (dstate) {
     case 1: // show text without scrolling
-      if (count>=400)
-        state=0;
+      if (dcount>=400)
+        dstate=0;
       break;
     case 2: // wait a bit before starting scrolling
-      if (count>=120)
-        state=3;
+      if (dcount>=120)
+        dstate=3;
       break;
     case 3: // scroll the text
-      if (count>20) {
+      if (dcount>20) {
         if (display.scroll())
-          state=0;
-        count=0;
+          dstate=0;
+        dcount=0;
       }
       break;
   }
-  meter.start();
 }
 
 ISR(TIMER0_OVF_vect)
 {
-  // reset timer for next interrupt
-  TCNT0=0xc0;
+  // reload for next interrupt. added, so that counts passed before
+  // this runs are not lost and ticks stay 2.048ms on average
+  TCNT0+=0xc0;
+  ticks++;
+  // ticks are not queued up if main loop falls behind, overruns
+  // are counted from ticks
+  if (!tick_posted) {
+    tick_posted=1;
+    Events::post(EV_TICK,0,stamp());
+  }
 }
 
-ISR(WDT_vect)
+ISR(TIMER1_OVF_vect)
 {
+  meter.isr();
 }
 
+ISR(TIMER1_COMPA_vect)
+{
+  display.isr();
+}
+
+// watchdog runs in interrupt and reset mode, and main loop re-enables
+// interrupt on every tick. so if this ever runs, the main loop is
+// stuck and the next timeout resets
+EMPTY_INTERRUPT(WDT_vect)
+
+ISR(EE_READY_vect)
+{
+  settings.isr();
+}
+
+#ifdef TELEMETRY
+ISR(USART_UDRE_vect)
+{
+  Telemetry::tx_isr();
+}
+
+ISR(USART_RX_vect)
+{
+  Telemetry::rx_isr();
+}
+#endif
+
+// encoder is decoded on every pin change, detents are posted
 ISR(PCINT0_vect)
 {
+  int8_t i=encoder.read_encoder();
+  if (i)
+    Events::post(EV_ENCODER,i,stamp());
 }
 
+// button and power switch changes are posted with the new level,
+// button is debounced by main loop
 ISR(PCINT1_vect)
 {
+  static uint8_t last=0xff;
+  uint8_t c=PINC^last;
+  last^=c;
+  if (c&0x04)
+    Events::post(EV_BUTTON,(last>>2)&1,stamp());
+  if (c&0x01)
+    Events::post(EV_POWER,last&1,stamp());
 }
 
 /*
@@ -217,12 +570,23 @@ PB2 /CE1                              output        1    1
 PB3 /CE2                              output        1    1
 PB4 encoder A                         input,pullup  0    1
 PB5 encoder B                         input,pullup  0    1
+PB6 XTAL1, CLOCK=RC: scanner SCL      open drain    0    0
+PB7 XTAL2, CLOCK=RC: scanner SDA      open drain    0    0
 */
 
 int main(void)
 {
   MCUSR=0;
   MCUCR=0;
+#ifdef CLOCK_RC
+  // the clock must not change by more than 2% at a time
+  while (OSCCAL!=RC_OSCCAL) {
+    if (OSCCAL<RC_OSCCAL)
+      OSCCAL++;
+    else
+      OSCCAL--;
+  }
+#endif
   // I/O directions
   DDRC=0x3a;
   DDRD=0xff;
@@ -232,7 +596,7 @@ int main(void)
   PORTD=0x80;
   PORTB=0x3c;
   //
-  PCMSK1=0x04; // PCINT10 enable
+  PCMSK1=0x05; // PCINT8,10 enable
   PCMSK0=0x30; // PCINT4,5 enable
   PCICR=3;     // enable PCINT0,PCINT1
   set_sleep_mode(SLEEP_MODE_IDLE);
@@ -244,64 +608,191 @@ int main(void)
   TIMSK0=1; // enable overflow interrupts
   TCNT0=0xc0;
   display.clear();
+#ifdef TELEMETRY
+  Telemetry::start();
+#endif
   sei();
   display.puts("NORADIO");
+  radio.i2c_init();
+#ifdef DISPLAY_HT16K33
+  display.attach(&radio);
+#endif
   if (!radio.is_connected())
-    while (1);
-  display.clear();
+    while (1)
+      radio.i2c_idle(get_ticks());
+  // start radio oscillator, and do the rest of initialization
+  // while it settles. radio powerup is completed in BOOT state
+#ifdef SCANNER
+  scanner.prepare();
+#endif
   radio.init();
-  frequency=eeprom_read_word(&ee_frequency);
-  if (frequency>radio.get_max_frequency())
-    frequency=radio.get_max_frequency();
-  if (frequency<radio.get_min_frequency())
-    frequency=radio.get_min_frequency();
+#ifdef SCANNER
+  scanner.init();
+#endif
+  display.puts("********"); // display test pattern until tuned
+  settings.load();
+  if (settings.has_channel())
+    channel=settings.get_channel();
+  else
+    channel=radio.frequency_channel(settings.get_frequency());
   radio.set_decoder(&decoder);
-  radio.set_mono(0);
-  radio.set_soft_mute(1);
-  enum POWERSTATE { POWER_ON,STAY_ON,POWER_OFF,STAY_OFF };
-  uint8_t tcount=0,powerstate=(PINC&1)?POWER_OFF:POWER_ON;
+#ifdef TMC
+  decoder.set_tmc(&tmc);
+#endif
+  if (!(PINC&1)) {
+    PORTC&=~2; // meter backlight on
+    meter.start();
+  }
+  enum POWERSTATE { BOOT,POWER_ON,POWER_WAIT,STAY_ON,POWER_OFF,STAY_OFF };
+  uint8_t tcount=0,powerstate=BOOT,power_switch=PINC&1,button_active=0,r;
+  uint16_t now,last_tick=0;
+  Event ev;
   while (1) {
-    sleep_cpu(); // timer ot pin change interrupt wakes us up
+    // interrupts that main loop needs to react to post events, meter
+    // and EEPROM interrupts do not. sei() delays interrupts by one
+    // instruction, so no event can be missed between test and sleep
+    cli();
+    while (!Events::pending()) {
+      sei();
+      sleep_cpu();
+      cli();
+    }
+    sei();
+    if (!Events::get(&ev,get_stamp()))
+      continue;
+    now=get_ticks();
+    switch (ev.type) {
+      case EV_ENCODER:
+        if (powerstate==STAY_ON)
+          encoder_turned(ev.arg);
+        continue;
+      case EV_BUTTON:  // debounce on ticks until released
+        button_active=1;
+        continue;
+      case EV_POWER:
+        power_switch=ev.arg;
+        continue;
+      case EV_TUNED:
+        if (powerstate!=STAY_ON)
+          continue;
+        set_channel(radio.get_channel());
+        if (!boot_ticks)
+          boot_ticks=now;
+        if (ptyseek.run(now))
+          radio_display(1);
+        continue;
+      case EV_RDS:
+        if (powerstate==STAY_ON && ptyseek.run(now))
+          radio_display(1);
+        continue;
+      case EV_TICK:
+        tick_posted=0;
+        break;
+      default:
+        continue;
+    }
+    if ((uint16_t)(now-last_tick)>1)
+      overruns++;
+    last_tick=now;
     wdt_reset();
     WDTCSR=(1<<WDIE) | (1<<WDP2) | (1<<WDP1) | (1<<WDP0);
+    settings.run();
+    if (button_active) {
+      if (powerstate==STAY_ON)
+        button_pressed(encoder.read_button());
+      else
+        encoder.read_button();
+      button_active=!encoder.button_idle();
+    }
     switch (powerstate)
     {
+      case BOOT:
+        if (radio.boot(now)) {
+          // stored channel may be from a build for other region
+          if (channel>radio.get_max_channel())
+            channel=radio.get_max_channel();
+          set_channel(channel);
+          powerstate=power_switch?POWER_OFF:POWER_ON;
+        }
+        break;
       case STAY_ON:
-        if (PINC&1) {
+        if (power_switch) {
           powerstate=POWER_OFF;
           break;
         }
+        decoder.tick();
+#ifdef TMC
+        tmc.run(now);
+#endif
+#ifdef SCANNER
+        scanner.run(now);
+#endif
+        // reads the radio only when a poll is due
+        r=radio.run(now);
+        if (r&RADIO_FAILED) // channel read from chip is not valid,
+          ptyseek.cancel(); // keep the old one
+        else if (r&RADIO_TUNED)
+          Events::post_main(EV_TUNED,0,get_stamp());
+        if (r&RADIO_GROUP)
+          Events::post_main(EV_RDS,0,get_stamp());
         if ((tcount&3)==0)
-        {
-          radio.run();
           meter.set(radio.get_rssi());
-        }
+#ifdef TELEMETRY
+        run_telemetry();
+#endif
         tcount=(tcount+1)&3;
-        radio_display();
+        radio_display(ptyseek.run(now)); // show new station from the beginning
         break;
       case STAY_OFF:
-        if (!(PINC&1))
+        if (!power_switch)
           powerstate=POWER_ON;
         break;
       default:
       case POWER_OFF:
+        ptyseek.cancel();
+        radio.begin();
         radio.set_volume(0);
-        meter.stop();
-        PORTC|=2; // meter backlight off
         radio.sleep();
+        radio.commit();
+#ifdef SCANNER
+        scanner.sleep();
+#endif
+        meter.off();
+        PORTC|=2; // meter backlight off
+        settings.flush();
         display.clear();
         powerstate=STAY_OFF;
         break;
       case POWER_ON:
         radio.wakeup();
-        radio.set_frequency(frequency);
+#ifdef SCANNER
+        scanner.wakeup();
+#endif
+        powerstate=POWER_WAIT;
+        break;
+      case POWER_WAIT:
+        // chip can not be tuned during powerup time. volume and tuning
+        // go to the chip in one write, audio comes on as soon as tune
+        // completes. run() finishes the tuning
+        if (power_switch) {
+          powerstate=POWER_OFF;
+          break;
+        }
+        if (!radio.boot(now))
+          break;
+        radio.begin();
+        radio.set_volume(settings.get_volume());
+        radio.tune_channel(channel);
+        radio.commit();
         PORTC&=~2; // meter backlight on
         meter.start();
         radio_display(1);
-        radio.set_volume(3);
         tcount=0;
         powerstate=STAY_ON;
         break;
     }
+    // display and other low priority bus users go after the radio
+    radio.i2c_idle(now);
+    display.run();
   }
 }
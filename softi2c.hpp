@@ -0,0 +1,198 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __softi2c_hpp__
+#define __softi2c_hpp__
+#include <avr/io.h>
+#include <util/delay.h>
+#include "si4703.hpp"
+
+// second I2C bus, bit-banged on PB6 (SCL) and PB7 (SDA). these are the
+// crystal pins, so a board with the second bus is a hardware variant
+// that runs from the calibrated internal RC oscillator, build with
+// CLOCK=RC and OSCCAL, see Makefile. both lines need external pullups.
+// the pins are driven open drain, PORTB bits stay 0 and a line is
+// pulled low by making it an output
+#define SOFT_DDR DDRB
+#define SOFT_PIN PINB
+#define SOFT_SCL 0x40
+#define SOFT_SDA 0x80
+#define SOFT_HALF_US 2      // half of clock period, about 200kHz
+#define SOFT_STRETCH 250    // us to wait for slave to release SCL
+
+// Si4703 on the bit-banged bus. the chip shares reset line with the
+// one on TWI, so it comes out of reset together with that, and needs
+// its SDIO held low by hold() at the time
+//
+class SoftSI4703 : public SI4703
+{
+  void delay() { _delay_us(SOFT_HALF_US); }
+  void sda_low() { SOFT_DDR|=SOFT_SDA; }
+  void sda_high() { SOFT_DDR&=~SOFT_SDA; }
+  void scl_low() { SOFT_DDR|=SOFT_SCL; }
+
+  // release SCL and wait for slave clock stretching to end
+  uint8_t scl_high()
+  {
+    uint8_t n=SOFT_STRETCH;
+    SOFT_DDR&=~SOFT_SCL;
+    while (!(SOFT_PIN&SOFT_SCL)) {
+      if (!--n) {
+        i2c_errors.timeouts++;
+        return 0;
+      }
+      _delay_us(1);
+    }
+    return 1;
+  }
+
+  // start condition, SDA falling while SCL high. a stuck bus is
+  // cleared by clocking out the byte a slave is holding SDA for
+  uint8_t start()
+  {
+    uint8_t i;
+    sda_high();
+    if (!scl_high())
+      return 0;
+    for (i=0;i<9 && !(SOFT_PIN&SOFT_SDA);i++) {
+      if (!i)
+        i2c_errors.recoveries++;
+      scl_low();
+      delay();
+      if (!scl_high())
+        return 0;
+      delay();
+    }
+    delay();
+    sda_low();
+    delay();
+    scl_low();
+    return 1;
+  }
+
+  void stop()
+  {
+    sda_low();
+    delay();
+    scl_high();
+    delay();
+    sda_high();
+    delay();
+  }
+
+  // send byte, returns 1 if slave acknowledged
+  uint8_t put(uint8_t c)
+  {
+    uint8_t i,ack;
+    for (i=0;i<8;i++,c<<=1) {
+      if (c&0x80)
+        sda_high();
+      else
+        sda_low();
+      delay();
+      if (!scl_high())
+        return 0;
+      delay();
+      scl_low();
+    }
+    sda_high();
+    delay();
+    if (!scl_high())
+      return 0;
+    ack=!(SOFT_PIN&SOFT_SDA);
+    delay();
+    scl_low();
+    if (!ack)
+      i2c_errors.naks++;
+    return ack;
+  }
+
+  // receive byte, and acknowledge it if more are wanted. returns 0
+  // if slave held the clock too long
+  uint8_t get(uint8_t *p,uint8_t ack)
+  {
+    uint8_t i,c=0;
+    sda_high();
+    for (i=0;i<8;i++) {
+      delay();
+      if (!scl_high())
+        return 0;
+      c=(c<<1)|((SOFT_PIN&SOFT_SDA)?1:0);
+      delay();
+      scl_low();
+    }
+    if (ack)
+      sda_low();
+    delay();
+    if (!scl_high())
+      return 0;
+    delay();
+    scl_low();
+    sda_high();
+    *p=c;
+    return 1;
+  }
+
+protected:
+
+  void chip_reset() { }
+
+  // same contract as TWI transfers in BaseRadio
+  uint8_t i2c_write(uint8_t slave,uint8_t *buf,uint8_t count)
+  {
+    uint8_t n=0;
+    I2C_TRACE_START();
+    if (start()) {
+      if (put(slave<<1))
+        while (n<count && put(buf[n]))
+          n++;
+      stop();
+    }
+    I2C_TRACE(slave,count|I2C_TRACE_SOFT,n);
+    return n;
+  }
+
+  uint8_t i2c_read(uint8_t slave,uint8_t *buf,uint8_t count)
+  {
+    uint8_t n=0;
+    I2C_TRACE_START();
+    if (start()) {
+      if (put((slave<<1)|1))
+        while (n<count && get(&buf[n],n<count-1))
+          n++;
+      stop();
+    }
+    I2C_TRACE(slave|I2C_TRACE_READ,count|I2C_TRACE_SOFT,n);
+    return n;
+  }
+
+public:
+
+  const char *name() { return "Si4703 soft I2C"; }
+
+  // hold SDIO low while the shared reset line is pulsed
+  static void hold() { SOFT_DDR|=SOFT_SDA; }
+  static void release() { SOFT_DDR&=~SOFT_SDA; }
+};
+
+#endif
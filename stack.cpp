@@ -0,0 +1,63 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stack.hpp"
+
+extern uint8_t _end;    // end of static data, from linker
+extern uint8_t __stack; // top of stack
+
+// runs from .init1, before stack pointer and zero register are set
+// up, so it is written in assembly and uses only the Z pointer
+void stack_paint(void) __attribute__((naked,used,section(".init1")));
+
+void stack_paint(void)
+{
+  __asm volatile (
+    "    ldi r30,lo8(_end)\n"
+    "    ldi r31,hi8(_end)\n"
+    "    ldi r24,%0\n"
+    "    ldi r25,hi8(__stack)\n"
+    "    rjmp 2f\n"
+    "1:  st Z+,r24\n"
+    "2:  cpi r30,lo8(__stack)\n"
+    "    cpc r31,r25\n"
+    "    brlo 1b\n"
+    "    breq 1b\n"
+    :: "M" (STACK_CANARY));
+}
+
+uint16_t stack_headroom(void)
+{
+  const uint8_t *p=&_end;
+  uint16_t n=0;
+  while (p<=&__stack && *p==STACK_CANARY) {
+    p++;
+    n++;
+  }
+  return n;
+}
+
+uint16_t static_ram(void)
+{
+  return &_end-(uint8_t*)RAMSTART;
+}
@@ -0,0 +1,145 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include "telemetry.hpp"
+
+#ifdef TELEMETRY
+
+#define UBRR_VALUE ((F_CPU+TELEMETRY_BAUD*4UL)/(TELEMETRY_BAUD*8UL)-1)
+
+uint8_t Telemetry::txbuf[TELEMETRY_TXSIZE];
+volatile uint8_t Telemetry::txhead;
+volatile uint8_t Telemetry::txtail;
+volatile uint8_t Telemetry::txactive;
+uint8_t Telemetry::rxbuf[TELEMETRY_RXSIZE+3];
+volatile uint8_t Telemetry::rxpos=0xff;
+volatile uint8_t Telemetry::rxready;
+
+void Telemetry::start()
+{
+  UBRR0=UBRR_VALUE;
+  UCSR0A=(1<<U2X0);
+  UCSR0C=(1<<UCSZ01)|(1<<UCSZ00); // 8N1
+  claim();
+}
+
+void Telemetry::release()
+{
+  if (!(UCSR0B&(1<<TXEN0)))
+    return;
+  while (txhead!=txtail);
+  if (txactive)
+    while (!(UCSR0A&(1<<TXC0)));
+  txactive=0;
+  UCSR0B=0;
+}
+
+uint8_t Telemetry::try_release()
+{
+  if (!(UCSR0B&(1<<TXEN0)))
+    return 1;
+  if (txhead!=txtail || (txactive && !(UCSR0A&(1<<TXC0))))
+    return 0;
+  txactive=0;
+  UCSR0B=0;
+  return 1;
+}
+
+void Telemetry::claim()
+{
+  if (txhead!=txtail)
+    UCSR0B=(1<<RXCIE0)|(1<<UDRIE0)|(1<<RXEN0)|(1<<TXEN0);
+  else
+    UCSR0B=(1<<RXCIE0)|(1<<RXEN0)|(1<<TXEN0);
+}
+
+uint8_t Telemetry::send(uint8_t type,const void *payload,uint8_t len)
+{
+  uint8_t i,c,crc=0xff;
+  if ((uint8_t)(TELEMETRY_TXSIZE-1-((txhead-txtail)&(TELEMETRY_TXSIZE-1)))<len+4)
+    return 0;
+  put(FRAME_SYNC);
+  put(len);
+  crc=_crc8_ccitt_update(crc,len);
+  put(type);
+  crc=_crc8_ccitt_update(crc,type);
+  for (i=0;i<len;i++) {
+    c=((const uint8_t*)payload)[i];
+    put(c);
+    crc=_crc8_ccitt_update(crc,c);
+  }
+  put(crc);
+  if (UCSR0B&(1<<TXEN0))
+    UCSR0B|=(1<<UDRIE0);
+  return 1;
+}
+
+const uint8_t *Telemetry::receive(uint8_t *type,uint8_t *len)
+{
+  if (!rxready)
+    return NULL;
+  *len=rxbuf[0];
+  *type=rxbuf[1];
+  return rxbuf+2;
+}
+
+void Telemetry::tx_isr()
+{
+  if (txhead==txtail) {
+    UCSR0B&=~(1<<UDRIE0);
+    return;
+  }
+  UCSR0A=(UCSR0A&(1<<U2X0))|(1<<TXC0); // clear transmit complete
+  UDR0=txbuf[txtail];
+  txtail=(txtail+1)&(TELEMETRY_TXSIZE-1);
+  txactive=1;
+}
+
+void Telemetry::rx_isr()
+{
+  uint8_t i,crc=0xff,c=UDR0;
+  if (rxready)                // previous frame not handled yet
+    return;
+  if (rxpos==0xff) {          // waiting for sync
+    if (c==FRAME_SYNC)
+      rxpos=0;
+    return;
+  }
+  if (rxpos==0 && c>TELEMETRY_RXSIZE) {
+    rxpos=0xff;
+    return;
+  }
+  rxbuf[rxpos++]=c;
+  if (rxpos<rxbuf[0]+3)
+    return;
+  for (i=0;i<rxpos-1;i++)
+    crc=_crc8_ccitt_update(crc,rxbuf[i]);
+  if (crc==c)
+    rxready=1;
+  else
+    rxpos=0xff;
+}
+
+#endif
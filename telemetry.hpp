@@ -0,0 +1,142 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __telemetry_hpp__
+#define __telemetry_hpp__
+#include <avr/io.h>
+#include <string.h>
+
+// debug build option. the USART pins PD0 (RXD) and PD1 (TXD) are also
+// display data lines D0 and D1, so the USART is switched off for the
+// duration of display updates. host TX line must be connected to RXD
+// through a series resistor (1k or so), as the pin is driven as output
+// while display is written
+#define noTELEMETRY
+
+#define TELEMETRY_BAUD 38400
+#define TELEMETRY_TXSIZE 128     // transmit ring size, must be power of 2
+#define TELEMETRY_RXSIZE 24      // longest accepted frame
+#define TELEMETRY_INTERVAL 64    // ticks between telemetry records
+
+// frames in both directions are
+//   FRAME_SYNC, length, type, payload[length], crc8
+// where crc8 is CCITT crc over length, type and payload, starting from 0xff.
+// a frame with bad crc is dropped, host repeats commands that are not
+// acknowledged
+#define FRAME_SYNC 0x7e
+
+enum FRAME_TYPES {
+  FRAME_TELEMETRY=0x01,  // TelemetryRecord
+  FRAME_REGISTERS=0x02,  // 16 radio registers, 0..15
+  FRAME_ACK=0x03,        // number of commands executed from batch
+  FRAME_RDSSTATS=0x04,   // RDSStats
+  FRAME_PTYSTATS=0x05,   // PTYStats
+  FRAME_EVENTSTATS=0x06, // EventStats
+  FRAME_TMCSTATS=0x07,   // TMCStats
+  FRAME_STATION=0x08,    // uint8_t table index, Station
+  FRAME_SCANSTATS=0x09,  // ScanStats, I2CErrors of scanner bus
+  FRAME_I2CTRACE=0x0a,   // I2CTraceTotals, I2CErrors of TWI bus,
+                         // I2C_TRACE_SIZE I2CTraceEntry oldest first
+  FRAME_COMMANDS=0x80    // batch of commands from host
+};
+
+// commands in FRAME_COMMANDS payload, each followed by its arguments
+enum COMMANDS {
+  CMD_TUNE=0x01,   // uint16_t frequency in 10kHz units
+  CMD_VOLUME=0x02, // uint8_t volume 0..15
+  CMD_SEEK=0x03,   // uint8_t direction, 0=down 1=up
+  CMD_DUMP=0x04,   // no arguments, answered with FRAME_REGISTERS
+  CMD_RDSSTATS=0x05, // no arguments, answered with FRAME_RDSSTATS
+  CMD_PTYSEEK=0x06,  // uint8_t program type, uint8_t direction, 0=down 1=up
+  CMD_PTYSTATS=0x07, // no arguments, answered with FRAME_PTYSTATS
+  CMD_EVENTSTATS=0x08, // no arguments, answered with FRAME_EVENTSTATS
+  CMD_TMCSTATS=0x09,   // no arguments, answered with FRAME_TMCSTATS
+  CMD_STATION=0x0a,    // uint8_t table index, answered with FRAME_STATION
+                       // or nothing if the entry is unused
+  CMD_SCANSTATS=0x0b,  // no arguments, answered with FRAME_SCANSTATS
+  CMD_I2CTRACE=0x0c    // no arguments, answered with FRAME_I2CTRACE
+};
+
+#define TM_STEREO 0x01 // TelemetryRecord flags
+#define TM_TUNING 0x02
+
+// all multibyte values are little endian
+struct TelemetryRecord
+{
+  uint16_t ticks;      // time of record
+  uint16_t frequency;  // in 10kHz units
+  uint8_t rssi;
+  uint8_t flags;
+  uint16_t pi;         // RDS program identification
+  uint16_t overruns;   // main loop iterations that took over a tick
+  uint16_t boot_ticks; // power on to audio time
+  uint16_t meter_lost; // meter PWM counts lost to display bursts
+  uint16_t headroom;   // SRAM never reached by stack, bytes
+  uint16_t static_ram; // SRAM used by static data, bytes
+};
+
+// framed binary protocol on USART. transmit is buffered in a ring
+// that is drained by data register empty interrupt, receive collects
+// one frame at a time from receive interrupt
+//
+class Telemetry
+{
+  static uint8_t txbuf[TELEMETRY_TXSIZE];
+  static volatile uint8_t txhead,txtail;
+  static volatile uint8_t txactive; // byte handed to USART after last TXC
+  static uint8_t rxbuf[TELEMETRY_RXSIZE+3]; // length, type, payload, crc
+  static volatile uint8_t rxpos;    // bytes in rxbuf, 0xff while waiting for sync
+  static volatile uint8_t rxready;  // rxbuf has a complete valid frame
+
+  static void put(uint8_t c)
+  {
+    txbuf[txhead]=c;
+    txhead=(txhead+1)&(TELEMETRY_TXSIZE-1);
+  }
+
+public:
+
+  static void start();
+
+  // wait until everything is sent, and disconnect USART from pins
+  static void release();
+  // disconnect USART from pins if nothing is being sent, returns 0
+  // if it is still busy
+  static uint8_t try_release();
+  // connect USART back to pins
+  static void claim();
+
+  // queue a frame for sending, returns 0 if there is no room
+  static uint8_t send(uint8_t type,const void *payload,uint8_t len);
+
+  // returns pointer to payload of received frame, or NULL if there is
+  // none. done() must be called after the frame is handled
+  static const uint8_t *receive(uint8_t *type,uint8_t *len);
+  static void done() { rxpos=0xff; rxready=0; }
+
+  // USART data register empty and receive complete interrupts
+  static void tx_isr();
+  static void rx_isr();
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <avr/pgmspace.h>
+#include "tmc.hpp"
+#include "meter.hpp"
+
+#ifdef TMC
+
+// message lifetime for duration and persistence codes 0..7, in expiry
+// clock units. 15 min, 15 min, 30 min, 1h, 2h, 3h, 4h and rest of the
+// day, which is limited to 8h to stay within half of 13 bit clock range
+static const uint16_t persistence[8] PROGMEM =
+{
+  107,107,215,429,858,1287,1716,3433
+};
+
+// data bits following each free format label, ISO 14819-1 table 5
+static const uint8_t label_bits[16] PROGMEM =
+{
+  3,3,5,5,5,8,8,8,8,11,16,16,16,16,0,0
+};
+
+void TMCStore::set_expiry(uint8_t slot,uint8_t duration)
+{
+  messages[slot].duration=duration;
+  messages[slot].expires=clock+pgm_read_word(&persistence[duration]);
+}
+
+void TMCStore::free_slot(uint8_t slot)
+{
+  tag[slot]=0;
+  messages[slot].event=0;
+  stats.used--;
+  if (mg_slot==slot)
+    mg_index=0;
+}
+
+// store message, or refresh it if it is already in the table.
+// returns slot used
+uint8_t TMCStore::store(uint16_t location,uint16_t event,uint8_t extent,
+  uint8_t direction,uint8_t diversion,uint8_t duration)
+{
+  uint8_t h=hash(location,event,direction),i,slot=TMC_SLOTS;
+  uint16_t left,least=0xffff;
+  TMCMessage *m;
+  for (i=0;i<TMC_SLOTS;i++) {
+    if (tag[i]==h) {
+      m=&messages[i];
+      if (m->location==location && m->event==event && m->direction==direction) {
+        m->extent=extent;
+        m->diversion=diversion;
+        set_expiry(i,duration);
+        stats.repeats++;
+        return i;
+      }
+    }
+    else if (!tag[i] && slot==TMC_SLOTS)
+      slot=i;
+  }
+  if (slot==TMC_SLOTS) {
+    // table full, drop the message that would expire first
+    for (i=0;i<TMC_SLOTS;i++) {
+      left=(messages[i].expires-clock)&0x1fff;
+      if (left<least) {
+        least=left;
+        slot=i;
+      }
+    }
+    free_slot(slot);
+    stats.evicted++;
+  }
+  m=&messages[slot];
+  m->location=location;
+  m->event=event;
+  m->extent=extent;
+  m->direction=direction;
+  m->diversion=diversion;
+  set_expiry(slot,duration);
+  tag[slot]=h;
+  stats.stored++;
+  if (++stats.used>stats.high_water)
+    stats.high_water=stats.used;
+  return slot;
+}
+
+// 8A block b low bits are tuning flag, single group flag and duration
+// or continuity index. in single group messages and first group of
+// multi-group messages block c has diversion or first group flag,
+// direction, extent and event code, and block d has location.
+// subsequent groups carry 28 bits of free format data
+void TMCStore::decode_group(uint16_t b,uint16_t c,uint16_t d)
+{
+  uint32_t bits;
+  uint8_t pos,label,n;
+  if (b&0x10)               // tuning information, not a message
+    return;
+  if (b&0x08) {             // single group message
+    mg_index=0;
+    store(d,c&0x07ff,(c>>11)&7,(c>>14)&1,c>>15,b&7);
+    return;
+  }
+  if (!(b&7))               // continuity index 0 is reserved
+    return;
+  if (c&0x8000) {           // first group, duration comes in label 0
+    mg_slot=store(d,c&0x07ff,(c>>11)&7,(c>>14)&1,0,0);
+    mg_index=b&7;
+    return;
+  }
+  // only the second group is looked at, it has duration if the
+  // message has one
+  if ((b&7)!=mg_index || !(c&0x4000))
+    return;
+  mg_index=0;
+  bits=((uint32_t)(c&0x0fff)<<16)|d;
+  pos=28;
+  while (pos>=4) {
+    pos-=4;
+    label=(bits>>pos)&15;
+    n=pgm_read_byte(&label_bits[label]);
+    if (label==15 || n>pos)
+      return;
+    if (label==0) {
+      set_expiry(mg_slot,(bits>>(pos-3))&7);
+      return;
+    }
+    pos-=n;
+  }
+}
+
+void TMCStore::decode(uint16_t b,uint16_t c,uint16_t d)
+{
+  uint16_t start=meter_count(),cycles;
+  stats.groups++;
+  decode_group(b,c,d);
+  cycles=meter_cycles(start);
+  if (cycles) {
+    if (cycles>stats.cycles_max)
+      stats.cycles_max=cycles;
+    stats.cycles_total+=cycles;
+    stats.timed++;
+  }
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __tmc_hpp__
+#define __tmc_hpp__
+#include <avr/io.h>
+#include <string.h>
+
+// traffic message channel decoder, RDS group 8A. build option, rename
+// to TMC to enable. costs TMC_SLOTS*7+30 bytes of RAM
+#define noTMC
+
+#define TMC_SLOTS 16          // stored messages, at most 255
+#define TMC_AGE_SHIFT 12      // expiry clock unit is 4096 ticks, 8.4s
+
+// one stored message, 6 bytes. event code 0 is not used by
+// the event list, so it marks a free slot
+struct TMCMessage
+{
+  uint16_t location;          // location code, from service location table
+  uint16_t event:11;          // event code
+  uint16_t extent:3;          // number of locations affected
+  uint16_t direction:1;       // negative direction of location table
+  uint16_t diversion:1;       // diversion advised
+  uint16_t expires:13;        // expiry time, in 4096 tick units
+  uint16_t duration:3;        // duration and persistence code
+};
+
+struct TMCStats
+{
+  uint16_t groups;       // 8A groups decoded
+  uint16_t stored;       // new messages stored
+  uint16_t repeats;      // repeated messages, only refreshed expiry
+  uint16_t evicted;      // messages dropped to make room
+  uint16_t expired;      // messages aged out
+  uint8_t used;          // slots in use now
+  uint8_t high_water;    // most slots ever in use
+  uint16_t cycles_max;   // longest group decode, cpu cycles
+  uint32_t cycles_total; // total group decode time, cpu cycles
+  uint16_t timed;        // groups in cycles_total, decode is timed only
+                         // while Timer1 runs
+};
+
+// messages are kept until their persistence ends, per ISO 14819-1
+// duration code. a transmission of a message already in the table
+// refreshes it. tag[] has a one byte hash of location, event and
+// direction for each slot, so that finding a repeat compares bytes
+// and reads full entries only on tag match. one slot is checked for
+// expiry on each tick, so aging costs the same every tick
+//
+class TMCStore
+{
+  TMCMessage messages[TMC_SLOTS];
+  uint8_t tag[TMC_SLOTS];
+  uint8_t age_slot;      // next slot to check for expiry
+  uint16_t now;          // time of last run()
+  uint16_t clock;        // expiry clock, in 4096 tick units
+  uint8_t mg_index;      // continuity index of multi-group message, 0 if none
+  uint8_t mg_slot;       // slot where its first group was stored
+  TMCStats stats;
+
+  static uint8_t hash(uint16_t location,uint16_t event,uint8_t direction)
+  {
+    uint8_t h=(location>>8)^(location&0xff)^(event>>3)^(event<<5)^direction;
+    return h?h:1; // tag 0 marks free slot
+  }
+
+  uint8_t expired(uint8_t slot)
+  {
+    return ((uint16_t)(clock-messages[slot].expires)&0x1fff)<0x1000;
+  }
+
+  void set_expiry(uint8_t slot,uint8_t duration);
+  void free_slot(uint8_t slot);
+  uint8_t store(uint16_t location,uint16_t event,uint8_t extent,
+    uint8_t direction,uint8_t diversion,uint8_t duration);
+  void decode_group(uint16_t b,uint16_t c,uint16_t d);
+
+public:
+
+  // decode block b, c and d of 8A group
+  void decode(uint16_t b,uint16_t c,uint16_t d);
+
+  // age out one slot, to be called on every tick
+  void run(uint16_t t)
+  {
+    if ((t^now)>>TMC_AGE_SHIFT)
+      clock++;
+    now=t;
+    if (tag[age_slot] && expired(age_slot)) {
+      free_slot(age_slot);
+      stats.expired++;
+    }
+    if (++age_slot>=TMC_SLOTS)
+      age_slot=0;
+  }
+
+  // message in slot, or NULL if the slot is free
+  const TMCMessage *get(uint8_t slot) { return tag[slot]?&messages[slot]:NULL; }
+
+  const TMCStats *get_stats() { return &stats; }
+
+  void clear()
+  {
+    memset(tag,0,sizeof(tag));
+    memset(messages,0,sizeof(messages));
+    mg_index=0;
+    stats.used=0;
+  }
+
+  TMCStore() : age_slot(0), now(0), clock(0)
+  {
+    memset(&stats,0,sizeof(stats));
+    clear();
+  }
+};
+
+#endif
@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2016 Madis Kaal <mast@nomad.ee>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# host side client for the TELEMETRY debug build, see telemetry.hpp
+# for the frame format. works with a real serial port, or with the
+# pseudo terminal of a simulator uart model
+#
+#   radiomon.py /dev/ttyUSB0                      print telemetry records
+#   radiomon.py /dev/ttyUSB0 tune 9780 volume 5   send a batch of commands
+#   radiomon.py /dev/pts/3 seek up dump stats
+#   radiomon.py /dev/ttyUSB0 ptyseek 1 up         next News station
+#   radiomon.py /dev/ttyUSB0 i2c                  I2CTRACE build, bus log
+#
+import struct
+import sys
+import time
+
+import serial
+
+FRAME_SYNC = 0x7e
+FRAME_TELEMETRY = 0x01
+FRAME_REGISTERS = 0x02
+FRAME_ACK = 0x03
+FRAME_RDSSTATS = 0x04
+FRAME_PTYSTATS = 0x05
+FRAME_EVENTSTATS = 0x06
+FRAME_TMCSTATS = 0x07
+FRAME_STATION = 0x08
+FRAME_SCANSTATS = 0x09
+FRAME_I2CTRACE = 0x0a
+FRAME_COMMANDS = 0x80
+
+CMD_TUNE = 0x01
+CMD_VOLUME = 0x02
+CMD_SEEK = 0x03
+CMD_DUMP = 0x04
+CMD_RDSSTATS = 0x05
+CMD_PTYSEEK = 0x06
+CMD_PTYSTATS = 0x07
+CMD_EVENTSTATS = 0x08
+CMD_TMCSTATS = 0x09
+CMD_STATION = 0x0a
+CMD_SCANSTATS = 0x0b
+CMD_I2CTRACE = 0x0c
+
+TELEMETRY = struct.Struct("<HHBBHHHHHH")
+RDSSTATS = struct.Struct("<32H5HHIH")
+PTYSTATS = struct.Struct("<4HI")
+EVENTS = ("tick", "encoder", "button", "power", "rds", "tuned")
+EVENTSTATS = struct.Struct("<%dH%dHH" % (len(EVENTS), len(EVENTS)))
+TMCSTATS = struct.Struct("<5HBBHIH")
+STATION = struct.Struct("<BHHBb8sB")
+SCANSTATS = struct.Struct("<5H4H")
+I2CTOTALS = struct.Struct("<HHIH4H")
+I2CENTRY = struct.Struct("<HBBB")
+TICK = 0.002048
+
+
+def crc8(data, crc=0xff):
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xff if crc & 0x80 else (crc << 1) & 0xff
+    return crc
+
+
+def frame(ftype, payload):
+    body = bytes([len(payload), ftype]) + payload
+    return bytes([FRAME_SYNC]) + body + bytes([crc8(body)])
+
+
+def frames(port):
+    """yield (type, payload) of valid frames, resyncing on errors.
+    (None, None) is yielded on read timeout"""
+    while True:
+        c = port.read(1)
+        if not c:
+            yield None, None
+            continue
+        if c[0] != FRAME_SYNC:
+            continue
+        hdr = port.read(2)
+        if len(hdr) < 2:
+            continue
+        rest = port.read(hdr[0] + 1)
+        if len(rest) < hdr[0] + 1 or crc8(hdr + rest[:-1]) != rest[-1]:
+            continue
+        yield hdr[1], rest[:-1]
+
+
+def parse_commands(args):
+    out = bytearray()
+    args = list(args)
+    while args:
+        cmd = args.pop(0)
+        if cmd == "tune":
+            out += struct.pack("<BH", CMD_TUNE, int(args.pop(0)))
+        elif cmd == "volume":
+            out += struct.pack("<BB", CMD_VOLUME, int(args.pop(0)))
+        elif cmd == "seek":
+            out += struct.pack("<BB", CMD_SEEK, args.pop(0) == "up")
+        elif cmd == "dump":
+            out += bytes([CMD_DUMP])
+        elif cmd == "stats":
+            out += bytes([CMD_RDSSTATS])
+        elif cmd == "ptyseek":
+            out += struct.pack("<BBB", CMD_PTYSEEK, int(args.pop(0)), args.pop(0) == "up")
+        elif cmd == "ptystats":
+            out += bytes([CMD_PTYSTATS])
+        elif cmd == "events":
+            out += bytes([CMD_EVENTSTATS])
+        elif cmd == "tmc":
+            out += bytes([CMD_TMCSTATS])
+        elif cmd == "station":
+            out += struct.pack("<BB", CMD_STATION, int(args.pop(0)))
+        elif cmd == "scan":
+            out += bytes([CMD_SCANSTATS])
+        elif cmd == "i2c":
+            out += bytes([CMD_I2CTRACE])
+        else:
+            raise SystemExit("unknown command %s" % cmd)
+    return bytes(out)
+
+
+def show(ftype, payload):
+    if ftype == FRAME_TELEMETRY:
+        t, f, rssi, flags, pi, over, boot, lost, headroom, sram = \
+            TELEMETRY.unpack(payload[:TELEMETRY.size])
+        print("%8.3f %6.2fMHz rssi=%-3d %s%s pi=%04X overruns=%d boot=%dms meterlost=%d "
+              "ram=%d headroom=%d" % (
+                  t * TICK, f / 100.0, rssi,
+                  "ST" if flags & 1 else "MO", " TUNING" if flags & 2 else "",
+                  pi, over, boot * TICK * 1000, lost, sram, headroom))
+    elif ftype == FRAME_REGISTERS:
+        regs = struct.unpack("<16H", payload)
+        for i in range(0, 16, 4):
+            print("  %2d: %s" % (i, " ".join("%04X" % r for r in regs[i:i + 4])))
+    elif ftype == FRAME_RDSSTATS:
+        v = RDSSTATS.unpack(payload)
+        groups, (rejected, toggles, ps, rt, missed, cmax, ctotal, timed) = v[:32], v[32:]
+        print("  groups: %s" % " ".join("%d%s=%d" % (i >> 1, "AB"[i & 1], n)
+                                       for i, n in enumerate(groups) if n))
+        print("  rejected=%d toggles=%d missed=%d" % (rejected, toggles, missed))
+        if timed:
+            print("  decode cycles avg=%d max=%d" % (ctotal / timed, cmax))
+        print("  ps complete %s, rt complete %s" % tuple(
+            "%dms" % (t * TICK * 1000) if t else "-" for t in (ps, rt)))
+    elif ftype == FRAME_PTYSTATS:
+        candidates, cached, rejected, no_rds, ticks = PTYSTATS.unpack(payload)
+        print("  candidates=%d cached=%d rejected=%d no_rds=%d" % (
+            candidates, cached, rejected, no_rds))
+        if rejected + no_rds:
+            print("  %dms per rejected candidate" % (
+                ticks * TICK * 1000 / (rejected + no_rds)))
+    elif ftype == FRAME_EVENTSTATS:
+        v = EVENTSTATS.unpack(payload)
+        n = len(EVENTS)
+        for name, count, latency in zip(EVENTS, v[:n], v[n:2 * n]):
+            print("  %-8s count=%-6d max latency=%.2fms" % (name, count, latency * 0.032))
+        print("  dropped=%d" % v[-1])
+    elif ftype == FRAME_TMCSTATS:
+        groups, stored, repeats, evicted, expired, used, high, cmax, ctotal, timed = \
+            TMCSTATS.unpack(payload)
+        print("  groups=%d stored=%d repeats=%d evicted=%d expired=%d" % (
+            groups, stored, repeats, evicted, expired))
+        print("  slots used=%d high water=%d" % (used, high))
+        if timed:
+            print("  decode cycles avg=%d max=%d" % (ctotal / timed, cmax))
+    elif ftype == FRAME_STATION:
+        i, channel, pi, rssi, pty, ps, seen = STATION.unpack(payload)
+        print("  %2d: channel %d rssi=%-3d pi=%04X pty=%d ps=%r" % (
+            i, channel, rssi, pi, pty, ps.rstrip(b"\0").decode("latin-1")))
+    elif ftype == FRAME_SCANSTATS:
+        passes, found, named, replaced, dropped, timeouts, naks, arb, rec = \
+            SCANSTATS.unpack(payload)
+        print("  passes=%d found=%d named=%d replaced=%d dropped=%d" % (
+            passes, found, named, replaced, dropped))
+        print("  bus timeouts=%d naks=%d recoveries=%d" % (timeouts, naks, rec))
+    elif ftype == FRAME_I2CTRACE:
+        transfers, failed, nbytes, rate, timeouts, naks, arb, rec = \
+            I2CTOTALS.unpack(payload[:I2CTOTALS.size])
+        print("  transfers=%d failed=%d bytes=%d %dB/s" % (
+            transfers, failed, nbytes, rate / (32768 * 0.000032)))
+        print("  twi timeouts=%d naks=%d arbitration=%d recoveries=%d" % (
+            timeouts, naks, arb, rec))
+        prev = None
+        for i in range(I2CTOTALS.size, len(payload), I2CENTRY.size):
+            stamp, addr, length, done = I2CENTRY.unpack(payload[i:i + I2CENTRY.size])
+            if not length:
+                continue
+            print("  %+8.3fms %s %02X %s %2d/%-2d%s" % (
+                ((stamp - prev) & 0xffff) * 0.032 if prev is not None else 0.0,
+                "soft" if length & 0x80 else "twi ", addr & 0x7f,
+                "rd" if addr & 0x80 else "wr", done, length & 0x7f,
+                "" if done == length & 0x7f else " FAILED"))
+            prev = stamp
+    elif ftype == FRAME_ACK:
+        print("ack, %d commands executed" % payload[0])
+
+
+def main():
+    if len(sys.argv) < 2:
+        raise SystemExit(__doc__ or "usage: radiomon.py port [commands]")
+    port = serial.Serial(sys.argv[1], 38400, timeout=0.5)
+    batch = parse_commands(sys.argv[2:])
+    if not batch:
+        for ftype, payload in frames(port):
+            show(ftype, payload)
+    # the device may miss a frame while display is being written,
+    # so repeat until acknowledged. note that a batch may get executed
+    # twice if the acknowledgement is lost
+    ftype = None
+    for _ in range(10):
+        port.write(frame(FRAME_COMMANDS, batch))
+        deadline = time.time() + 1.0
+        for ftype, payload in frames(port):
+            if ftype not in (None, FRAME_TELEMETRY):
+                show(ftype, payload)
+            if ftype == FRAME_ACK or time.time() > deadline:
+                break
+        if ftype == FRAME_ACK:
+            return
+    raise SystemExit("no acknowledgement")
+
+
+if __name__ == "__main__":
+    main()